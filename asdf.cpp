@@ -5,6 +5,12 @@
 #include <sstream>
 #include <cctype>
 #include <memory>
+#include <chrono>
+#include <functional>
+#include <algorithm>
+#include <cstdlib>
+#include <list>
+#include "bench_suite.h"
 
 // Tokenizer code as above...
 #include <sstream>
@@ -208,26 +214,227 @@ private:
     size_t position;
 };
 
-int main() {
+// Number of nodes in a statement's tree.
+size_t countNodes(ASTNode* node) {
+    if (!node) {
+        return 0;
+    } else if (auto binary = dynamic_cast<BinaryOpNode*>(node)) {
+        return 1 + countNodes(binary->left.get()) + countNodes(binary->right.get());
+    } else if (auto assignment = dynamic_cast<AssignmentNode*>(node)) {
+        return 1 + countNodes(assignment->expression.get());
+    } else if (auto print = dynamic_cast<PrintNode*>(node)) {
+        return 1 + countNodes(print->expression.get());
+    }
+    return 1;
+}
+
+// Parsed statements of recent REPL lines, so a line typed, pasted or replayed
+// again skips the tokenizer and parser. Entries are found by the hash of the
+// line text, with the text compared on a hit, and the least recently used are
+// evicted once the entries' estimated size passes the cap.
+class ParseCache {
+public:
+    explicit ParseCache(size_t capacityBytes) : capacity(capacityBytes) {}
+
+    // The statement for the line, parsing it on a miss. Null on a syntax error.
+    ASTNode* get(const std::string& line) {
+        size_t hash = std::hash<std::string>()(line);
+        auto found = index.find(hash);
+        if (found != index.end() && found->second->line == line) {
+            hits++;
+            entries.splice(entries.begin(), entries, found->second);
+            return entries.front().ast.get();
+        }
+        misses++;
+        std::vector<Token> tokens = Tokenizer(line).tokenize();
+        std::unique_ptr<ASTNode> ast = Parser(tokens).parse();
+        size_t bytes = entryBytes(line, ast.get());
+        if (bytes > capacity) {
+            uncached = std::move(ast);
+            return uncached.get();
+        }
+        if (found != index.end()) remove(found->second); // Same hash, other text: the new line wins
+        entries.push_front({line, hash, std::move(ast), bytes});
+        index[hash] = entries.begin();
+        used += bytes;
+        while (used > capacity) {
+            remove(std::prev(entries.end()));
+            evictions++;
+        }
+        return entries.front().ast.get();
+    }
+
+    void report(std::ostream& out) const {
+        out << "Parse cache: " << hits << " hits, " << misses << " misses, " << evictions << " evictions, "
+            << entries.size() << " lines in " << used << " of " << capacity << " bytes\n";
+    }
+
+    size_t hits = 0, misses = 0, evictions = 0;
+
+private:
+    struct Entry {
+        std::string line;
+        size_t hash;
+        std::unique_ptr<ASTNode> ast;
+        size_t bytes;
+    };
+
+    // An estimate: the line, its index slot and list node, and every tree
+    // node counted at the size of the largest one.
+    static size_t entryBytes(const std::string& line, ASTNode* ast) {
+        return sizeof(Entry) + 4 * sizeof(void*) + line.capacity() + countNodes(ast) * sizeof(AssignmentNode);
+    }
+
+    void remove(std::list<Entry>::iterator entry) {
+        used -= entry->bytes;
+        index.erase(entry->hash);
+        entries.erase(entry);
+    }
+
+    size_t capacity;
+    size_t used = 0;
+    std::list<Entry> entries; // Most recently used first
+    std::unordered_map<size_t, std::list<Entry>::iterator> index;
+    std::unique_ptr<ASTNode> uncached; // The last statement too big to cache
+};
+
+const size_t DEFAULT_CACHE_MB = 64;
+
+// This REPL has no parentheses and no IF, so those two workloads of
+// --bench-suite are reported as unsupported.
+const SuiteDialect ASDF_DIALECT = {false, nullptr, nullptr};
+
+// Front end and evaluator cost per unit of work for each workload, as one
+// JSON object: ns per token for the tokenizer, ns per AST node for the parser
+// and ns per executed statement for the evaluator. Each figure is the best of
+// several passes.
+void benchmarkSuite(size_t lines) {
+    std::cout << "{\"variant\": \"asdf\", \"lines\": " << lines << ", \"workloads\": [";
+    for (int w = 0; w < WORKLOAD_COUNT; w++) {
+        Workload workload = static_cast<Workload>(w);
+        std::vector<std::string> source = generateWorkload(workload, lines, ASDF_DIALECT);
+        std::cout << (w ? ",\n  " : "\n  ") << "{\"name\": \"" << workloadName(workload) << "\"";
+        if (source.empty()) {
+            std::cout << ", \"supported\": false}";
+            continue;
+        }
+
+        std::vector<std::vector<Token>> tokens(source.size());
+        double tokenizeNs = bestOf(5, [&] {
+            for (size_t i = 0; i < source.size(); i++) tokens[i] = Tokenizer(source[i]).tokenize();
+        });
+        size_t tokenCount = 0;
+        for (const auto& line : tokens) tokenCount += line.size();
+
+        std::vector<std::unique_ptr<ASTNode>> trees(tokens.size());
+        double parseNs = bestOf(5, [&] {
+            for (size_t i = 0; i < tokens.size(); i++) trees[i] = Parser(tokens[i]).parse();
+        });
+        size_t nodeCount = 0;
+        for (const auto& tree : trees) nodeCount += countNodes(tree.get());
+
+        std::unordered_map<std::string, int> variables;
+        NullBuffer null;
+        std::streambuf* console = std::cout.rdbuf(&null);
+        double evalNs = bestOf(20, [&] {
+            for (auto& tree : trees) tree->evaluate(variables);
+        });
+        std::cout.rdbuf(console);
+
+        std::cout << ", \"statements\": " << trees.size() << ", \"tokens\": " << tokenCount
+                  << ", \"nodes\": " << nodeCount
+                  << ", \"ns_per_token\": " << tokenizeNs / tokenCount
+                  << ", \"ns_per_node_parse\": " << parseNs / nodeCount
+                  << ", \"ns_per_statement_eval\": " << evalNs / trees.size() << "}";
+    }
+    std::cout << "\n]}\n";
+}
+
+// Front-end cost of replaying a recorded session: the lines of the
+// long-expression, many-variable and print workloads interleaved, parsed from
+// scratch and then fed twice through the parse cache. The long expressions
+// repeat one line, like a pasted block, so the first replay already hits on
+// those; the second hits on every line.
+void benchmarkCache(size_t lines) {
+    using Clock = std::chrono::steady_clock;
+    std::vector<std::vector<std::string>> parts = {generateWorkload(LONG_EXPRESSIONS, lines, ASDF_DIALECT),
+                                                   generateWorkload(MANY_VARIABLES, lines, ASDF_DIALECT),
+                                                   generateWorkload(PRINT_HEAVY, lines, ASDF_DIALECT)};
+    std::vector<std::string> session;
+    for (size_t i = 0; session.size() < lines; i++) {
+        for (const auto& part : parts) {
+            if (i < part.size() && session.size() < lines) session.push_back(part[i]);
+        }
+    }
+
+    auto time = [](const std::function<void()>& pass) {
+        auto start = Clock::now();
+        pass();
+        return std::chrono::duration<double, std::nano>(Clock::now() - start).count();
+    };
+    size_t statements = 0;
+    double parseNs = time([&] {
+        for (const auto& line : session) {
+            std::vector<Token> tokens = Tokenizer(line).tokenize();
+            statements += Parser(tokens).parse() != nullptr;
+        }
+    });
+    ParseCache cache(DEFAULT_CACHE_MB << 20);
+    double coldNs = time([&] {
+        for (const auto& line : session) statements += cache.get(line) != nullptr;
+    });
+    double warmNs = time([&] {
+        for (const auto& line : session) statements += cache.get(line) != nullptr;
+    });
+
+    size_t n = session.size();
+    std::cout << "session of " << n << " lines, " << statements / 3 << " parsed\n"
+              << "parse every line: " << parseNs / n << " ns/line\n"
+              << "first replay: " << coldNs / n << " ns/line\n"
+              << "second replay: " << warmNs / n << " ns/line (" << parseNs / warmNs << "x)\n";
+    cache.report(std::cout);
+}
+
+int main(int argc, char* argv[]) {
+    size_t cacheBytes = DEFAULT_CACHE_MB << 20;
+    bool cacheStats = false;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        bool hasCount = i + 1 < argc && isdigit(static_cast<unsigned char>(argv[i + 1][0]));
+        if (arg == "--bench-suite") {
+            benchmarkSuite(hasCount ? std::max(1, std::atoi(argv[i + 1])) : 2000);
+            return 0;
+        } else if (arg == "--bench-cache") {
+            benchmarkCache(hasCount ? std::max(1, std::atoi(argv[i + 1])) : 10000);
+            return 0;
+        } else if (arg == "--cache-mb" && hasCount) {
+            cacheBytes = std::strtoull(argv[++i], nullptr, 10) << 20;
+        } else if (arg == "--cache-stats") {
+            cacheStats = true;
+        } else {
+            std::cerr << "Usage: " << argv[0]
+                      << " [--cache-mb n] [--cache-stats] [--bench-suite [lines]] [--bench-cache [lines]]\n";
+            return 1;
+        }
+    }
+
     std::unordered_map<std::string, int> variables;
+    ParseCache cache(cacheBytes);
     std::string input;
     std::cout << "BASIC Interpreter\nEnter exit to quit.\n";
     while (true) {
         std::cout << "> ";
-        std::getline(std::cin, input);
+        if (!std::getline(std::cin, input)) break;
         if (input == "EXIT" && "exit") break;
 
-        Tokenizer tokenizer(input);
-        std::vector<Token> tokens = tokenizer.tokenize();
-
-        Parser parser(tokens);
-        std::unique_ptr<ASTNode> ast = parser.parse();
+        ASTNode* ast = cache.get(input);
         if (ast) {
             ast->evaluate(variables);
         } else {
             std::cout << "Syntax error!" << std::endl;
         }
     }
+    if (cacheStats) cache.report(std::cerr);
     return 0;
 }
 
@@ -0,0 +1,99 @@
+// The synthetic workloads and timing helpers of --bench-suite, shared by
+// modify.cpp, interpreter.cpp and asdf.cpp. Each workload is straight-line
+// code, so every statement runs exactly once per pass; each program writes it
+// in its own dialect, described by a SuiteDialect.
+#ifndef BENCH_SUITE_H
+#define BENCH_SUITE_H
+
+#include <algorithm>
+#include <chrono>
+#include <streambuf>
+#include <string>
+#include <vector>
+
+enum Workload {
+    LONG_EXPRESSIONS,   // 100-term expressions
+    MANY_VARIABLES,     // A fresh variable on every line
+    DEEP_NESTING,       // Parentheses nested 50 deep
+    PRINT_HEAVY,
+    IF_HEAVY,
+    WORKLOAD_COUNT
+};
+
+inline const char* workloadName(Workload workload) {
+    static const char* const names[WORKLOAD_COUNT] = {
+        "long-expressions", "many-variables", "deep-nesting", "print-heavy", "if-heavy"};
+    return names[workload];
+}
+
+// What a dialect can express. An IF-heavy line is ifOpen, the condition,
+// ifClose and then the two branches; a null ifOpen means there is no IF.
+struct SuiteDialect {
+    bool parentheses;
+    const char* ifOpen;
+    const char* ifClose;
+};
+
+// The workload's lines, or none if it cannot be written in the dialect.
+inline std::vector<std::string> generateWorkload(Workload workload, size_t lines, const SuiteDialect& dialect) {
+    if ((workload == DEEP_NESTING && !dialect.parentheses) || (workload == IF_HEAVY && !dialect.ifOpen)) return {};
+    std::vector<std::string> source;
+    for (size_t k = 1; k <= lines; k++) {
+        std::string n = std::to_string(k);
+        switch (workload) {
+            case LONG_EXPRESSIONS: {
+                if (k % 10 != 0) continue; // A tenth as many lines, each ten times as long
+                std::string line = "e = a0";
+                for (unsigned t = 1; t < 100; t++) {
+                    line += (t % 2 ? " + a" : " - a") + std::to_string(t % 8) + " * " + std::to_string(t % 9 + 1);
+                }
+                source.push_back(line);
+                break;
+            }
+            case MANY_VARIABLES:
+                source.push_back("v" + n + " = v" + std::to_string(k - 1) + " + " + std::to_string(k % 10));
+                break;
+            case DEEP_NESTING: {
+                if (k % 10 != 0) continue;
+                std::string expression = "d";
+                for (unsigned level = 1; level <= 50; level++) {
+                    expression = "(" + expression + (level % 2 ? " + " : " - ") + std::to_string(level) + ")";
+                }
+                source.push_back("d = " + expression);
+                break;
+            }
+            case PRINT_HEAVY:
+                source.push_back("PRINT p * " + n + " + 1");
+                break;
+            case IF_HEAVY:
+                source.push_back(std::string(dialect.ifOpen) + "f - " + std::to_string(k % 7) + dialect.ifClose
+                                 + "f = f + 1 ELSE f = f - 1");
+                break;
+            default:
+                break;
+        }
+    }
+    return source;
+}
+
+// The fastest of several passes, in nanoseconds.
+template <typename Pass>
+double bestOf(int runs, Pass pass) {
+    using Clock = std::chrono::steady_clock;
+    double best = 1e30;
+    for (int i = 0; i < runs; i++) {
+        auto start = Clock::now();
+        pass();
+        best = std::min(best, std::chrono::duration<double, std::nano>(Clock::now() - start).count());
+    }
+    return best;
+}
+
+// Swallows PRINT output while an evaluator that prints to std::cout is timed.
+class NullBuffer : public std::streambuf {
+protected:
+    int overflow(int c) override { return c; }
+    std::streamsize xsputn(const char*, std::streamsize count) override { return count; }
+};
+
+#endif
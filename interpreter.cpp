@@ -5,6 +5,15 @@
 #include <sstream>
 #include <cctype>
 #include <memory>
+#include <algorithm>
+#include <cstdlib>
+#include <string_view>
+#include <charconv>
+#include <deque>
+#include <chrono>
+#include <fstream>
+#include <cstdio>
+#include "bench_suite.h"
 
 // Token types for new statements
 enum TokenType {
@@ -25,17 +34,26 @@ enum TokenType {
     END,
     RUN,
     EQUAL,
+    NOT_EQUAL,
+    LESS,
+    GREATER,
+    LESS_EQUAL,
+    GREATER_EQUAL,
+    AND,
+    OR,
     INVALID
 };
 
+// A token's text points into the source it was read from, which has to
+// outlive it.
 struct Token {
     TokenType type;
-    std::string value;
+    std::string_view value;
 };
 
 class Tokenizer {
 public:
-    Tokenizer(const std::string& source) : source(source), position(0) {}
+    Tokenizer(std::string_view source) : source(source), position(0) {}
 
     std::vector<Token> tokenize() {
         std::vector<Token> tokens;
@@ -64,10 +82,28 @@ public:
                             position++;
                         }
                         break;
+                    case '<':
+                        if (position + 1 < source.size() && (source[position + 1] == '>' || source[position + 1] == '=')) {
+                            tokens.push_back({source[position + 1] == '>' ? NOT_EQUAL : LESS_EQUAL, source.substr(position, 2)});
+                            position += 2;
+                        } else {
+                            tokens.push_back({LESS, "<"});
+                            position++;
+                        }
+                        break;
+                    case '>':
+                        if (position + 1 < source.size() && source[position + 1] == '=') {
+                            tokens.push_back({GREATER_EQUAL, ">="});
+                            position += 2;
+                        } else {
+                            tokens.push_back({GREATER, ">"});
+                            position++;
+                        }
+                        break;
                     case '(': tokens.push_back({LEFT_PAREN, "("}); position++; break;
                     case ')': tokens.push_back({RIGHT_PAREN, ")"}); position++; break;
                     case '%': tokens.push_back({MOD, "%"}); position++; break;
-                    default: tokens.push_back({INVALID, std::string(1, current)}); position++; break;
+                    default: tokens.push_back({INVALID, source.substr(position, 1)}); position++; break;
                 }
             }
         }
@@ -77,18 +113,19 @@ public:
 
 private:
     Token tokenizeNumber() {
-        std::string number;
+        size_t start = position;
         while (position < source.size() && isdigit(source[position])) {
-            number += source[position++];
+            position++;
         }
-        return {NUMBER, number};
+        return {NUMBER, source.substr(start, position - start)};
     }
 
     Token tokenizeIdentifier() {
-        std::string identifier;
+        size_t start = position;
         while (position < source.size() && isalnum(source[position])) {
-            identifier += source[position++];
+            position++;
         }
+        std::string_view identifier = source.substr(start, position - start);
         if (identifier == "PRINT") {
             return {PRINT, identifier};
         } else if (identifier == "INPUT") {
@@ -101,33 +138,63 @@ private:
             return {END, identifier};
         } else if (identifier == "RUN") {
             return {RUN, identifier};
+        } else if (identifier == "AND") {
+            return {AND, identifier};
+        } else if (identifier == "OR") {
+            return {OR, identifier};
         }
         return {IDENTIFIER, identifier};
     }
 
-    std::string source;
+    std::string_view source;
     size_t position;
 };
 
+// Variables are resolved to dense slot indices at parse time; at run time their
+// values live in a flat frame indexed by slot.
+using Frame = std::vector<int>;
+
+class SymbolTable {
+public:
+    int resolve(std::string_view name) {
+        auto it = slots.find(name);
+        if (it != slots.end()) {
+            return it->second;
+        }
+        int slot = static_cast<int>(names.size());
+        names.emplace_back(name);
+        slots.emplace(names.back(), slot);
+        return slot;
+    }
+
+    size_t size() const { return names.size(); }
+    const std::string& name(int slot) const { return names[slot]; }
+
+private:
+    // Keys view the names, which a deque never moves.
+    std::unordered_map<std::string_view, int> slots;
+    std::deque<std::string> names;
+};
+
 // Abstract Syntax Tree nodes
 struct ASTNode {
     virtual ~ASTNode() = default;
-    virtual int evaluate(std::unordered_map<std::string, int>& variables) = 0;
+    virtual int evaluate(Frame& frame) = 0;
 };
 
 struct NumberNode : public ASTNode {
     int value;
     explicit NumberNode(int value) : value(value) {}
-    int evaluate(std::unordered_map<std::string, int>&) override {
+    int evaluate(Frame&) override {
         return value;
     }
 };
 
 struct VariableNode : public ASTNode {
-    std::string name;
-    explicit VariableNode(const std::string& name) : name(name) {}
-    int evaluate(std::unordered_map<std::string, int>& variables) override {
-        return variables[name];
+    int slot;
+    explicit VariableNode(int slot) : slot(slot) {}
+    int evaluate(Frame& frame) override {
+        return frame[slot];
     }
 };
 
@@ -136,28 +203,36 @@ struct BinaryOpNode : public ASTNode {
     TokenType op;
     BinaryOpNode(std::unique_ptr<ASTNode> left, std::unique_ptr<ASTNode> right, TokenType op)
         : left(std::move(left)), right(std::move(right)), op(op) {}
-    int evaluate(std::unordered_map<std::string, int>& variables) override {
-        int leftVal = left->evaluate(variables);
-        int rightVal = right->evaluate(variables);
+    int evaluate(Frame& frame) override {
+        int leftVal = left->evaluate(frame);
+        int rightVal = right->evaluate(frame);
         switch (op) {
             case MOD: return leftVal % rightVal;
             case PLUS: return leftVal + rightVal;
             case MINUS: return leftVal - rightVal;
             case MULTIPLY: return leftVal * rightVal;
             case DIVIDE: return leftVal / rightVal;
+            case EQUAL: return leftVal == rightVal;
+            case NOT_EQUAL: return leftVal != rightVal;
+            case LESS: return leftVal < rightVal;
+            case GREATER: return leftVal > rightVal;
+            case LESS_EQUAL: return leftVal <= rightVal;
+            case GREATER_EQUAL: return leftVal >= rightVal;
+            case AND: return leftVal != 0 && rightVal != 0;
+            case OR: return leftVal != 0 || rightVal != 0;
             default: return 0;
         }
     }
 };
 
 struct AssignmentNode : public ASTNode {
-    std::string variable;
+    int slot;
     std::unique_ptr<ASTNode> expression;
-    AssignmentNode(const std::string& variable, std::unique_ptr<ASTNode> expression)
-        : variable(variable), expression(std::move(expression)) {}
-    int evaluate(std::unordered_map<std::string, int>& variables) override {
-        int value = expression->evaluate(variables);
-        variables[variable] = value;
+    AssignmentNode(int slot, std::unique_ptr<ASTNode> expression)
+        : slot(slot), expression(std::move(expression)) {}
+    int evaluate(Frame& frame) override {
+        int value = expression->evaluate(frame);
+        frame[slot] = value;
         return value;
     }
 };
@@ -165,21 +240,22 @@ struct AssignmentNode : public ASTNode {
 struct PrintNode : public ASTNode {
     std::unique_ptr<ASTNode> expression;
     explicit PrintNode(std::unique_ptr<ASTNode> expression) : expression(std::move(expression)) {}
-    int evaluate(std::unordered_map<std::string, int>& variables) override {
-        int value = expression->evaluate(variables);
+    int evaluate(Frame& frame) override {
+        int value = expression->evaluate(frame);
         std::cout << value << std::endl;
         return value;
     }
 };
 
 struct InputNode : public ASTNode {
+    int slot;
     std::string variable;
-    explicit InputNode(const std::string& variable) : variable(variable) {}
-    int evaluate(std::unordered_map<std::string, int>& variables) override {
+    InputNode(int slot, std::string_view variable) : slot(slot), variable(variable) {}
+    int evaluate(Frame& frame) override {
         int value;
         std::cout << "Enter value for " << variable << ": ";
         std::cin >> value;
-        variables[variable] = value;
+        frame[slot] = value;
         return value;
     }
 };
@@ -190,19 +266,32 @@ struct IfElseNode : public ASTNode {
     std::unique_ptr<ASTNode> elseBranch;
     IfElseNode(std::unique_ptr<ASTNode> condition, std::unique_ptr<ASTNode> thenBranch, std::unique_ptr<ASTNode> elseBranch)
         : condition(std::move(condition)), thenBranch(std::move(thenBranch)), elseBranch(std::move(elseBranch)) {}
-    int evaluate(std::unordered_map<std::string, int>& variables) override {
-        if (condition->evaluate(variables)) {
-            return thenBranch->evaluate(variables);
+    int evaluate(Frame& frame) override {
+        if (condition->evaluate(frame)) {
+            return thenBranch->evaluate(frame);
         } else if (elseBranch) {
-            return elseBranch->evaluate(variables);
+            return elseBranch->evaluate(frame);
         }
         return 0;
     }
 };
 
+// How tightly each binary operator binds in the parser; 0 for a token that
+// is not one. All of them are left-associative.
+int precedence(TokenType type) {
+    switch (type) {
+        case OR: return 1;
+        case AND: return 2;
+        case EQUAL: case NOT_EQUAL: case LESS: case GREATER: case LESS_EQUAL: case GREATER_EQUAL: return 3;
+        case PLUS: case MINUS: return 4;
+        case MULTIPLY: case DIVIDE: case MOD: return 5;
+        default: return 0;
+    }
+}
+
 class Parser {
 public:
-    explicit Parser(const std::vector<Token>& tokens) : tokens(tokens), position(0) {}
+    Parser(const std::vector<Token>& tokens, SymbolTable& symbols) : tokens(tokens), symbols(symbols), position(0) {}
 
     std::unique_ptr<ASTNode> parse() {
         return parseStatement();
@@ -213,95 +302,378 @@ private:
         if (tokens[position].type == PRINT) {
             position++;
             auto expr = parseExpression();
+            if (!expr) return nullptr;
             return std::make_unique<PrintNode>(std::move(expr));
         } else if (tokens[position].type == INPUT) {
             position++;
             if (tokens[position].type == IDENTIFIER) {
-                std::string varName = tokens[position].value;
+                std::string_view varName = tokens[position].value;
                 position++;
-                return std::make_unique<InputNode>(varName);
+                return std::make_unique<InputNode>(symbols.resolve(varName), varName);
             }
         } else if (tokens[position].type == IF) {
             position++;
             auto condition = parseExpression();
-            if (tokens[position].type == LEFT_PAREN) {
+            if (condition && tokens[position].type == LEFT_PAREN) {
                 position++;
                 auto thenBranch = parseStatement();
+                if (!thenBranch) return nullptr;
                 std::unique_ptr<ASTNode> elseBranch = nullptr;
                 if (tokens[position].type == ELSE) {
                     position++;
                     elseBranch = parseStatement();
+                    if (!elseBranch) return nullptr;
                 }
                 return std::make_unique<IfElseNode>(std::move(condition), std::move(thenBranch), std::move(elseBranch));
             }
         } else if (tokens[position].type == IDENTIFIER) {
-            std::string varName = tokens[position].value;
+            std::string_view varName = tokens[position].value;
             position++;
             if (tokens[position].type == ASSIGN) {
                 position++;
                 auto expr = parseExpression();
-                return std::make_unique<AssignmentNode>(varName, std::move(expr));
+                if (!expr) return nullptr;
+                return std::make_unique<AssignmentNode>(symbols.resolve(varName), std::move(expr));
             }
         }
         return nullptr;
     }
 
     std::unique_ptr<ASTNode> parseExpression() {
-        auto left = parseTerm();
-        while (position < tokens.size() && (tokens[position].type == PLUS || tokens[position].type == MINUS)) {
-            TokenType op = tokens[position].type;
-            position++;
-            auto right = parseTerm();
-            left = std::make_unique<BinaryOpNode>(std::move(left), std::move(right), op);
-        }
-        return left;
+        auto left = parseFactor();
+        return left ? parseOperators(std::move(left), 1) : nullptr;
     }
 
-    std::unique_ptr<ASTNode> parseTerm() {
-        auto left = parseFactor();
-        while (position < tokens.size() && (tokens[position].type == MULTIPLY || tokens[position].type == DIVIDE || tokens[position].type == MOD)) {
+    // Precedence climbing: folds operators binding at least minimum into
+    // left. A right operand only recurses for an operator binding tighter
+    // than the one before it.
+    std::unique_ptr<ASTNode> parseOperators(std::unique_ptr<ASTNode> left, int minimum) {
+        int current = precedence(tokens[position].type);
+        while (current >= minimum && current > 0) {
             TokenType op = tokens[position].type;
             position++;
             auto right = parseFactor();
+            if (!right) return nullptr;
+            int next = precedence(tokens[position].type);
+            while (next > current) {
+                right = parseOperators(std::move(right), current + 1);
+                if (!right) return nullptr;
+                next = precedence(tokens[position].type);
+            }
             left = std::make_unique<BinaryOpNode>(std::move(left), std::move(right), op);
+            current = next;
         }
         return left;
     }
 
     std::unique_ptr<ASTNode> parseFactor() {
-        Token current = tokens[position];
+        const Token& current = tokens[position];
         if (current.type == NUMBER) {
             position++;
-            return std::make_unique<NumberNode>(std::stoi(current.value));
+            int value = 0;
+            auto result = std::from_chars(current.value.data(), current.value.data() + current.value.size(), value);
+            if (result.ec != std::errc()) return nullptr; // Too big for an int
+            return std::make_unique<NumberNode>(value);
         } else if (current.type == IDENTIFIER) {
             position++;
-            return std::make_unique<VariableNode>(current.value);
+            return std::make_unique<VariableNode>(symbols.resolve(current.value));
         } else if (current.type == LEFT_PAREN) {
             position++;
             auto expr = parseExpression();
-            if (tokens[position].type == RIGHT_PAREN) {
+            if (expr && tokens[position].type == RIGHT_PAREN) {
                 position++;
                 return expr;
             }
-        } else if (current.type == EQUAL) {
-            position++;
-            return nullptr; // Handle comparison separately in condition parsing
         }
         return nullptr;
     }
 
     const std::vector<Token>& tokens;
+    SymbolTable& symbols;
     size_t position;
 };
 
-int main() {
-    std::unordered_map<std::string, int> variables;
+// A whole file's contents, memory-mapped read-only where the platform allows
+// and read into memory otherwise.
+#if defined(__unix__) || defined(__APPLE__)
+#define BASIC_MMAP 1
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#else
+#define BASIC_MMAP 0
+#endif
+
+class MappedFile {
+public:
+    MappedFile() = default;
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+    ~MappedFile() { close(); }
+
+    bool open(const std::string& path) {
+        close();
+#if BASIC_MMAP
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) return false;
+        struct stat info;
+        if (fstat(fd, &info) != 0) {
+            ::close(fd);
+            return false;
+        }
+        if (info.st_size > 0) {
+            void* mapped = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (mapped == MAP_FAILED) {
+                ::close(fd);
+                return false;
+            }
+            madvise(mapped, info.st_size, MADV_SEQUENTIAL);
+            mapping = mapped;
+            contents = std::string_view(static_cast<const char*>(mapped), info.st_size);
+        }
+        ::close(fd);
+        return true;
+#else
+        std::ifstream file(path, std::ios::binary);
+        if (!file) return false;
+        owned.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+        contents = owned;
+        return true;
+#endif
+    }
+
+    void close() {
+#if BASIC_MMAP
+        if (mapping) munmap(mapping, contents.size());
+        mapping = nullptr;
+#endif
+        contents = std::string_view();
+    }
+
+    std::string_view data() const { return contents; }
+
+private:
+    std::string_view contents;
+#if BASIC_MMAP
+    void* mapping = nullptr;
+#else
+    std::string owned;
+#endif
+};
+
+using Program = std::vector<std::unique_ptr<ASTNode>>;
+
+// Parses one line onto the end of program, as null if it is not a valid
+// statement. Blank lines are skipped.
+void parseLine(std::string_view text, SymbolTable& symbols, Program& program) {
+    std::vector<Token> tokens = Tokenizer(text).tokenize();
+    if (tokens.size() == 1 && tokens[0].value.empty()) return;
+    program.push_back(Parser(tokens, symbols).parse());
+}
+
+// Parses every line of source in place, without copying it line by line. A
+// '\r' before the '\n' is dropped.
+void loadSource(std::string_view source, SymbolTable& symbols, Program& program) {
+    while (!source.empty()) {
+        size_t end = source.find('\n');
+        std::string_view text = source.substr(0, end);
+        if (!text.empty() && text.back() == '\r') {
+            text.remove_suffix(1);
+        }
+        parseLine(text, symbols, program);
+        if (end == std::string_view::npos) break;
+        source.remove_prefix(end + 1);
+    }
+}
+
+// Runs every statement once, in order, on a frame sized for all of the
+// program's variables. A line that failed to parse reports its error in turn.
+void runProgram(const Program& program, const SymbolTable& symbols) {
+    Frame frame(symbols.size(), 0);
+    for (const auto& ast : program) {
+        if (ast) {
+            ast->evaluate(frame);
+        } else {
+            std::cout << "Syntax error!" << std::endl;
+        }
+    }
+}
+
+// Number of nodes in a statement's tree.
+size_t countNodes(ASTNode* node) {
+    if (!node) {
+        return 0;
+    } else if (auto binary = dynamic_cast<BinaryOpNode*>(node)) {
+        return 1 + countNodes(binary->left.get()) + countNodes(binary->right.get());
+    } else if (auto assignment = dynamic_cast<AssignmentNode*>(node)) {
+        return 1 + countNodes(assignment->expression.get());
+    } else if (auto print = dynamic_cast<PrintNode*>(node)) {
+        return 1 + countNodes(print->expression.get());
+    } else if (auto ifElse = dynamic_cast<IfElseNode*>(node)) {
+        return 1 + countNodes(ifElse->condition.get()) + countNodes(ifElse->thenBranch.get())
+            + countNodes(ifElse->elseBranch.get());
+    }
+    return 1;
+}
+
+// How this interpreter writes the --bench-suite workloads: its IF takes the
+// condition bare and opens the branches with '('.
+const SuiteDialect INTERPRETER_DIALECT = {true, "IF ", " ( "};
+
+// Front end and evaluator cost per unit of work for each workload, as one
+// JSON object: ns per token for the tokenizer, ns per AST node for the parser
+// and ns per executed statement for the evaluator. Each figure is the best of
+// several passes.
+void benchmarkSuite(size_t lines) {
+    std::cout << "{\"variant\": \"interpreter\", \"lines\": " << lines << ", \"workloads\": [";
+    for (int w = 0; w < WORKLOAD_COUNT; w++) {
+        Workload workload = static_cast<Workload>(w);
+        std::vector<std::string> source = generateWorkload(workload, lines, INTERPRETER_DIALECT);
+
+        std::vector<std::vector<Token>> tokens(source.size());
+        double tokenizeNs = bestOf(5, [&] {
+            for (size_t i = 0; i < source.size(); i++) tokens[i] = Tokenizer(source[i]).tokenize();
+        });
+        size_t tokenCount = 0;
+        for (const auto& line : tokens) tokenCount += line.size();
+
+        SymbolTable symbols;
+        std::vector<std::unique_ptr<ASTNode>> trees(tokens.size());
+        double parseNs = bestOf(5, [&] {
+            symbols = SymbolTable();
+            for (size_t i = 0; i < tokens.size(); i++) trees[i] = Parser(tokens[i], symbols).parse();
+        });
+        size_t nodeCount = 0;
+        for (const auto& tree : trees) nodeCount += countNodes(tree.get());
+
+        Frame frame(symbols.size(), 0);
+        NullBuffer null;
+        std::streambuf* console = std::cout.rdbuf(&null);
+        double evalNs = bestOf(20, [&] {
+            for (auto& tree : trees) tree->evaluate(frame);
+        });
+        std::cout.rdbuf(console);
+
+        std::cout << (w ? ",\n  " : "\n  ") << "{\"name\": \"" << workloadName(workload)
+                  << "\", \"statements\": " << trees.size() << ", \"tokens\": " << tokenCount
+                  << ", \"nodes\": " << nodeCount
+                  << ", \"ns_per_token\": " << tokenizeNs / tokenCount
+                  << ", \"ns_per_node_parse\": " << parseNs / nodeCount
+                  << ", \"ns_per_statement_eval\": " << evalNs / trees.size() << "}";
+    }
+    std::cout << "\n]}\n";
+}
+
+// A generated program of about the given number of bytes.
+std::string generateSource(size_t bytes) {
+    std::string source;
+    source.reserve(bytes + 64);
+    for (size_t k = 1; source.size() < bytes; k++) {
+        std::string name = "v" + std::to_string(k % 1000);
+        source += name + " = " + name + " * 3 + " + std::to_string(k % 10) + "\n";
+        source += "IF " + name + " - 42 ( PRINT " + name + " ELSE PRINT 0\n";
+    }
+    return source;
+}
+
+// Measures startup for a large program file: mapping it plus loading it.
+bool benchmarkLoad(size_t megabytes) {
+    using Clock = std::chrono::steady_clock;
+    const std::string path = "bench_load.bas";
+    {
+        std::ofstream file(path, std::ios::binary);
+        file << generateSource(megabytes << 20);
+        if (!file) {
+            std::cout << "Cannot write " << path << "!\n";
+            return false;
+        }
+    }
+
+    auto start = Clock::now();
+    MappedFile file;
+    bool ok = file.open(path);
+    auto mapped = Clock::now();
+    SymbolTable symbols;
+    Program program;
+    loadSource(file.data(), symbols, program);
+    auto loaded = Clock::now();
+    std::remove(path.c_str());
+    for (const auto& ast : program) ok = ok && ast;
+
+    auto ms = [](Clock::duration d) { return std::chrono::duration<double, std::milli>(d).count(); };
+    std::cout << "Source: " << file.data().size() << " bytes, " << program.size() << " statements"
+              << (ok ? "" : " (LOAD FAILED)") << "\n";
+    std::cout << "Map: " << ms(mapped - start) << " ms\n";
+    std::cout << "Load: " << ms(loaded - mapped) << " ms ("
+              << (file.data().size() / 1e6) / std::chrono::duration<double>(loaded - mapped).count() << " MB/s)\n";
+    return ok;
+}
+
+// The count after a flag, if the next argument is one.
+long optionalCount(int argc, char* argv[], int& i, long fallback) {
+    if (i + 1 < argc && isdigit(static_cast<unsigned char>(argv[i + 1][0]))) {
+        long value = std::atol(argv[++i]);
+        return value > 0 ? value : fallback;
+    }
+    return fallback;
+}
+
+int main(int argc, char* argv[]) {
+    std::string programPath;
+    std::string dataPath;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--bench-suite") {
+            benchmarkSuite(optionalCount(argc, argv, i, 2000));
+            return 0;
+        } else if (arg == "--bench-load") {
+            return benchmarkLoad(optionalCount(argc, argv, i, 100)) ? 0 : 1;
+        } else if (arg == "--data" && i + 1 < argc) {
+            dataPath = argv[++i];
+        } else if (arg[0] != '-') {
+            programPath = arg;
+        }
+    }
+
+    // INPUT reads the --data file if there is one, otherwise stdin.
+    std::ifstream data;
+    if (!dataPath.empty()) {
+        data.open(dataPath);
+        if (!data) {
+            std::cout << "Cannot read data file " << dataPath << "!" << std::endl;
+            return 1;
+        }
+    }
+    SymbolTable symbols;
+    Program program;
+    auto run = [&] {
+        std::streambuf* console = std::cin.rdbuf();
+        if (data.is_open()) std::cin.rdbuf(data.rdbuf());
+        runProgram(program, symbols);
+        std::cin.rdbuf(console);
+    };
+
+    // A program file given on the command line is mapped, loaded in place
+    // and run once; stdin is then left to INPUT. Unlike modify.cpp there is
+    // no --compile or --image: this interpreter runs the trees it parses and
+    // has no bytecode whose image could stand in for parsing.
+    if (!programPath.empty()) {
+        MappedFile programFile;
+        if (!programFile.open(programPath)) {
+            std::cout << "Cannot read program file " << programPath << "!" << std::endl;
+            return 1;
+        }
+        loadSource(programFile.data(), symbols, program);
+        run();
+        return 0;
+    }
+
     std::vector<std::string> lines;
     std::string input;
     std::cout << "BASIC Interpreter\nEnter END to finish input and RUN to execute.\n";
 
-    while (true) {
-        std::getline(std::cin, input);
+    while (std::getline(std::cin, input)) {
         if (input == "END") {
             break;
         }
@@ -312,18 +684,12 @@ int main() {
 
     std::getline(std::cin, input);
     if (input == "RUN") {
+        // Every line is parsed first, so the frame is sized once for all the
+        // variables.
         for (const auto& line : lines) {
-            Tokenizer tokenizer(line);
-            std::vector<Token> tokens = tokenizer.tokenize();
-
-            Parser parser(tokens);
-            std::unique_ptr<ASTNode> ast = parser.parse();
-            if (ast) {
-                ast->evaluate(variables);
-            } else {
-                std::cout << "Syntax error!" << std::endl;
-            }
+            parseLine(line, symbols, program);
         }
+        run();
     }
 
     return 0;
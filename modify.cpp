@@ -5,6 +5,30 @@
 #include <sstream>
 #include <cctype>
 #include <memory>
+#include <chrono>
+#include <cstdlib>
+#include <string_view>
+#include <charconv>
+#include <deque>
+#include <cstdint>
+#include <algorithm>
+#include <climits>
+#include <cerrno>
+#include <fstream>
+#include <functional>
+#include <cstdio>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <filesystem>
+#include <new>
+#include <cmath>
+#include <cstring>
+#include <map>
+#include <tuple>
+#include <cstddef>
+#include <cassert>
+#include "bench_suite.h"
 
 // Token types for new statements
 enum TokenType {
@@ -25,307 +49,6174 @@ enum TokenType {
     END,
     RUN,
     EQUAL,
+    GOTO,
+    GOSUB,
+    RETURN,
+    FOR,
+    TO,
+    STEP,
+    NEXT,
+    WHILE,
+    WEND,
+    DIM,
+    SAVE,
+    LOAD,
+    NOT_EQUAL,
+    LESS,
+    GREATER,
+    LESS_EQUAL,
+    GREATER_EQUAL,
+    AND,
+    OR,
     INVALID
 };
 
+// Character classification for the tokenizer. Source text is classified 64
+// bytes at a time into bitmasks (one bit per byte), so the end of a run of
+// spaces, digits or identifier characters is found with a bit scan instead of
+// a per-byte ctype call. SSE2/AVX2 versions are picked at runtime when the CPU
+// has them; every version must agree with the C-locale isspace/isdigit/isalnum.
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#define BASIC_X86_SIMD 1
+#include <immintrin.h>
+#else
+#define BASIC_X86_SIMD 0
+#endif
+
+struct CharClassMasks {
+    uint64_t space;
+    uint64_t digit;
+    uint64_t alnum;
+};
+
+using ClassifyFn = CharClassMasks (*)(const char* block);
+
+CharClassMasks classifyScalar(const char* block) {
+    CharClassMasks masks{0, 0, 0};
+    for (int i = 0; i < 64; i++) {
+        unsigned char c = static_cast<unsigned char>(block[i]);
+        uint64_t bit = uint64_t(1) << i;
+        if (c == ' ' || (c >= '\t' && c <= '\r')) masks.space |= bit;
+        if (c >= '0' && c <= '9') masks.digit |= bit;
+        if ((c >= '0' && c <= '9') || ((c | 0x20) >= 'a' && (c | 0x20) <= 'z')) masks.alnum |= bit;
+    }
+    return masks;
+}
+
+#if BASIC_X86_SIMD
+// Unsigned lo <= c <= hi using only signed byte compares.
+__attribute__((target("sse2"))) static inline __m128i inRange128(__m128i c, char lo, char hi) {
+    __m128i shifted = _mm_xor_si128(_mm_sub_epi8(c, _mm_set1_epi8(lo)), _mm_set1_epi8(char(0x80)));
+    return _mm_cmplt_epi8(shifted, _mm_set1_epi8(char((hi - lo + 1) ^ 0x80)));
+}
+
+__attribute__((target("sse2"))) CharClassMasks classifySse2(const char* block) {
+    CharClassMasks masks{0, 0, 0};
+    for (int i = 0; i < 64; i += 16) {
+        __m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i*>(block + i));
+        __m128i space = _mm_or_si128(_mm_cmpeq_epi8(c, _mm_set1_epi8(' ')), inRange128(c, '\t', '\r'));
+        __m128i digit = inRange128(c, '0', '9');
+        __m128i alpha = inRange128(_mm_or_si128(c, _mm_set1_epi8(0x20)), 'a', 'z');
+        masks.space |= uint64_t(uint16_t(_mm_movemask_epi8(space))) << i;
+        masks.digit |= uint64_t(uint16_t(_mm_movemask_epi8(digit))) << i;
+        masks.alnum |= uint64_t(uint16_t(_mm_movemask_epi8(_mm_or_si128(digit, alpha)))) << i;
+    }
+    return masks;
+}
+
+__attribute__((target("avx2"))) static inline __m256i inRange256(__m256i c, char lo, char hi) {
+    __m256i shifted = _mm256_xor_si256(_mm256_sub_epi8(c, _mm256_set1_epi8(lo)), _mm256_set1_epi8(char(0x80)));
+    return _mm256_cmpgt_epi8(_mm256_set1_epi8(char((hi - lo + 1) ^ 0x80)), shifted);
+}
+
+__attribute__((target("avx2"))) CharClassMasks classifyAvx2(const char* block) {
+    CharClassMasks masks{0, 0, 0};
+    for (int i = 0; i < 64; i += 32) {
+        __m256i c = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(block + i));
+        __m256i space = _mm256_or_si256(_mm256_cmpeq_epi8(c, _mm256_set1_epi8(' ')), inRange256(c, '\t', '\r'));
+        __m256i digit = inRange256(c, '0', '9');
+        __m256i alpha = inRange256(_mm256_or_si256(c, _mm256_set1_epi8(0x20)), 'a', 'z');
+        masks.space |= uint64_t(uint32_t(_mm256_movemask_epi8(space))) << i;
+        masks.digit |= uint64_t(uint32_t(_mm256_movemask_epi8(digit))) << i;
+        masks.alnum |= uint64_t(uint32_t(_mm256_movemask_epi8(_mm256_or_si256(digit, alpha)))) << i;
+    }
+    return masks;
+}
+#endif
+
+inline int countTrailingZeros(uint64_t bits) {
+#if defined(__GNUC__) || defined(__clang__)
+    return __builtin_ctzll(bits);
+#else
+    int count = 0;
+    while (!(bits & 1)) {
+        bits >>= 1;
+        count++;
+    }
+    return count;
+#endif
+}
+
+// The fastest classifier this CPU supports.
+ClassifyFn bestClassifier() {
+#if BASIC_X86_SIMD
+    static const ClassifyFn best = [] {
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2")) return &classifyAvx2;
+        if (__builtin_cpu_supports("sse2")) return &classifySse2;
+        return &classifyScalar;
+    }();
+    return best;
+#else
+    return &classifyScalar;
+#endif
+}
+
+// Answers "where does this run end" queries over a source buffer, classifying
+// each 64-byte block once and caching the masks of the current block.
+class CharClassifier {
+public:
+    CharClassifier(std::string_view source, ClassifyFn classify)
+        : source(source), classify(classify), blockStart(std::string_view::npos) {}
+
+    size_t endOfSpaces(size_t position) { return endOfRun(position, &CharClassMasks::space); }
+    size_t endOfDigits(size_t position) { return endOfRun(position, &CharClassMasks::digit); }
+    size_t endOfAlnum(size_t position) { return endOfRun(position, &CharClassMasks::alnum); }
+
+private:
+    size_t endOfRun(size_t position, uint64_t CharClassMasks::*run) {
+        for (;;) {
+            size_t block = position & ~size_t(63);
+            if (block != blockStart) {
+                load(block);
+            }
+            uint64_t outside = ~(masks.*run) >> (position - block);
+            if (outside) {
+                return position + countTrailingZeros(outside);
+            }
+            position = block + 64;
+        }
+    }
+
+    // Bytes past the end of the source read as NUL, which belongs to no run.
+    void load(size_t block) {
+        blockStart = block;
+        if (block + 64 <= source.size()) {
+            masks = classify(source.data() + block);
+        } else {
+            char padded[64] = {};
+            if (block < source.size()) {
+                source.copy(padded, source.size() - block, block);
+            }
+            masks = classify(padded);
+        }
+    }
+
+    std::string_view source;
+    ClassifyFn classify;
+    size_t blockStart;
+    CharClassMasks masks{0, 0, 0};
+};
+
+// A BASIC value: a 64-bit integer, or a double once a fraction is involved or
+// integer arithmetic overflows. Integers are tagged 0, so two values are both
+// integers exactly when their tags OR to 0 and the fast paths need one test.
+struct Value {
+    enum Tag : uint8_t {
+        INT = 0,
+        REAL = 1
+    };
+
+    union {
+        int64_t i;
+        double d;
+    };
+    Tag tag;
+
+    Value() : i(0), tag(INT) {}
+    Value(int64_t value) : i(value), tag(INT) {}
+    Value(int value) : i(value), tag(INT) {}
+    Value(double) = delete; // Doubles must say so, with real()
+
+    static Value real(double value) {
+        Value result;
+        result.d = value;
+        result.tag = REAL;
+        return result;
+    }
+
+    bool isInt() const { return tag == INT; }
+    double toDouble() const { return tag == INT ? static_cast<double>(i) : d; }
+    bool isTrue() const { return tag == INT ? i != 0 : d != 0; }
+
+    // Same tag and same bits, for checks that two runs agree.
+    bool identical(const Value& other) const { return tag == other.tag && i == other.i; }
+};
+
+// Longest text formatValue() writes.
+const size_t MAX_VALUE_TEXT = 32;
+
+// Integers in decimal; doubles in the shortest form that reads back exactly,
+// in scientific notation once they are too big for every digit to be exact
+// (so a promoted integer does not print as if it were still one).
+inline char* formatValue(char* out, Value value) {
+    char* end = out + MAX_VALUE_TEXT;
+    if (value.isInt()) return std::to_chars(out, end, value.i).ptr;
+    if (std::fabs(value.d) >= 1e16) return std::to_chars(out, end, value.d, std::chars_format::scientific).ptr;
+    return std::to_chars(out, end, value.d).ptr;
+}
+
+std::ostream& operator<<(std::ostream& out, Value value) {
+    char text[MAX_VALUE_TEXT];
+    return out.write(text, formatValue(text, value) - text);
+}
+
+// Tokens point into the source buffer rather than owning a copy of their text,
+// so the source must outlive them. NUMBER tokens carry their decoded value.
 struct Token {
     TokenType type;
-    std::string value;
+    std::string_view text;
+    Value number = 0;
 };
 
 class Tokenizer {
 public:
-    Tokenizer(const std::string& source) : source(source), position(0) {}
+    // Short sources are scanned byte by byte; longer ones go through the
+    // block classifier, which only pays off once there is a block to classify.
+    Tokenizer(std::string_view source)
+        : Tokenizer(source, source.size() >= 64 ? bestClassifier() : nullptr) {}
+
+    // Uses the given classifier, or the byte-at-a-time loop when it is null.
+    Tokenizer(std::string_view source, ClassifyFn classify)
+        : source(source), position(0), classifier(source, classify), vectorized(classify != nullptr) {}
 
     std::vector<Token> tokenize() {
         std::vector<Token> tokens;
+        tokenize(tokens);
+        return tokens;
+    }
+
+    // Refills the given vector, so a caller tokenizing many lines can reuse one.
+    void tokenize(std::vector<Token>& tokens) {
+        tokens.clear();
+        tokens.reserve(source.size() / 4 + 2);
         while (position < source.size()) {
             char current = source[position];
-            if (isspace(current)) {
-                position++;
+            if (isspace(static_cast<unsigned char>(current))) {
+                position = endOfSpaces(position + 1);
                 continue;
             }
-            if (isdigit(current)) {
+            if (isdigit(static_cast<unsigned char>(current))) {
                 tokens.push_back(tokenizeNumber());
-            } else if (isalpha(current)) {
+            } else if (isalpha(static_cast<unsigned char>(current))) {
                 tokens.push_back(tokenizeIdentifier());
             } else {
                 switch (current) {
-                    case '+': tokens.push_back({PLUS, "+"}); position++; break;
-                    case '-': tokens.push_back({MINUS, "-"}); position++; break;
-                    case '*': tokens.push_back({MULTIPLY, "*"}); position++; break;
-                    case '/': tokens.push_back({DIVIDE, "/"}); position++; break;
+                    case '+': tokens.push_back(single(PLUS)); break;
+                    case '-': tokens.push_back(single(MINUS)); break;
+                    case '*': tokens.push_back(single(MULTIPLY)); break;
+                    case '/': tokens.push_back(single(DIVIDE)); break;
                     case '=':
                         if (position + 1 < source.size() && source[position + 1] == '=') {
-                            tokens.push_back({EQUAL, "=="});
+                            tokens.push_back({EQUAL, source.substr(position, 2)});
                             position += 2; // Skip the next '='
                         } else {
-                            tokens.push_back({ASSIGN, "="});
-                            position++;
+                            tokens.push_back(single(ASSIGN));
+                        }
+                        break;
+                    case '<':
+                        if (position + 1 < source.size() && (source[position + 1] == '>' || source[position + 1] == '=')) {
+                            tokens.push_back({source[position + 1] == '>' ? NOT_EQUAL : LESS_EQUAL, source.substr(position, 2)});
+                            position += 2;
+                        } else {
+                            tokens.push_back(single(LESS));
+                        }
+                        break;
+                    case '>':
+                        if (position + 1 < source.size() && source[position + 1] == '=') {
+                            tokens.push_back({GREATER_EQUAL, source.substr(position, 2)});
+                            position += 2;
+                        } else {
+                            tokens.push_back(single(GREATER));
                         }
                         break;
-                    case '(': tokens.push_back({LEFT_PAREN, "("}); position++; break;
-                    case ')': tokens.push_back({RIGHT_PAREN, ")"}); position++; break;
-                    case '%': tokens.push_back({MOD, "%"}); position++; break;
-                    default: tokens.push_back({INVALID, std::string(1, current)}); position++; break;
+                    case '(': tokens.push_back(single(LEFT_PAREN)); break;
+                    case ')': tokens.push_back(single(RIGHT_PAREN)); break;
+                    case '%': tokens.push_back(single(MOD)); break;
+                    default: tokens.push_back(single(INVALID)); break;
                 }
             }
         }
-        tokens.push_back({END, ""});
-        return tokens;
+        tokens.push_back({END, source.substr(source.size())});
+    }
+
+    // Keywords are few and short, so switching on length (and first letter
+    // where lengths collide) leaves at most two comparisons per identifier.
+    static TokenType keyword(std::string_view word) {
+        switch (word.size()) {
+            case 2:
+                if (word == "IF") return IF;
+                if (word == "TO") return TO;
+                if (word == "OR") return OR;
+                break;
+            case 3:
+                if (word == "END") return END;
+                if (word == "AND") return AND;
+                if (word == "RUN") return RUN;
+                if (word == "FOR") return FOR;
+                if (word == "DIM") return DIM;
+                break;
+            case 4:
+                switch (word[0]) {
+                    case 'E': if (word == "ELSE") return ELSE; break;
+                    case 'G': if (word == "GOTO") return GOTO; break;
+                    case 'S':
+                        if (word == "STEP") return STEP;
+                        if (word == "SAVE") return SAVE;
+                        break;
+                    case 'N': if (word == "NEXT") return NEXT; break;
+                    case 'W': if (word == "WEND") return WEND; break;
+                    case 'L': if (word == "LOAD") return LOAD; break;
+                }
+                break;
+            case 5:
+                switch (word[0]) {
+                    case 'P': if (word == "PRINT") return PRINT; break;
+                    case 'I': if (word == "INPUT") return INPUT; break;
+                    case 'G': if (word == "GOSUB") return GOSUB; break;
+                    case 'W': if (word == "WHILE") return WHILE; break;
+                }
+                break;
+            case 6:
+                if (word == "RETURN") return RETURN;
+                break;
+        }
+        return IDENTIFIER;
     }
 
 private:
+    Token single(TokenType type) {
+        return {type, source.substr(position++, 1)};
+    }
+
+    // Digits, or digits '.' digits for a fraction.
     Token tokenizeNumber() {
-        std::string number;
-        while (position < source.size() && isdigit(source[position])) {
-            number += source[position++];
+        size_t start = position;
+        position = endOfDigits(position);
+        bool fraction = position + 1 < source.size() && source[position] == '.'
+            && isdigit(static_cast<unsigned char>(source[position + 1]));
+        if (fraction) {
+            position = endOfDigits(position + 1);
+        }
+        Token token{NUMBER, source.substr(start, position - start)};
+        const char* begin = token.text.data();
+        const char* end = begin + token.text.size();
+        if (fraction) {
+            double value;
+            std::from_chars(begin, end, value);
+            token.number = Value::real(value);
+        } else if (std::from_chars(begin, end, token.number.i).ec != std::errc()) {
+            token.type = INVALID; // Literal does not fit in 64 bits
         }
-        return {NUMBER, number};
+        return token;
     }
 
     Token tokenizeIdentifier() {
-        std::string identifier;
-        while (position < source.size() && isalnum(source[position])) {
-            identifier += source[position++];
-        }
-        if (identifier == "PRINT") {
-            return {PRINT, identifier};
-        } else if (identifier == "INPUT") {
-            return {INPUT, identifier};
-        } else if (identifier == "IF") {
-            return {IF, identifier};
-        } else if (identifier == "ELSE") {
-            return {ELSE, identifier};
-        } else if (identifier == "END") {
-            return {END, identifier};
-        } else if (identifier == "RUN") {
-            return {RUN, identifier};
-        }
-        return {IDENTIFIER, identifier};
+        size_t start = position;
+        position = endOfAlnum(position);
+        std::string_view identifier = source.substr(start, position - start);
+        return {keyword(identifier), identifier};
     }
 
-    std::string source;
+    size_t endOfSpaces(size_t from) {
+        if (vectorized) return classifier.endOfSpaces(from);
+        while (from < source.size() && isspace(static_cast<unsigned char>(source[from]))) from++;
+        return from;
+    }
+
+    size_t endOfDigits(size_t from) {
+        if (vectorized) return classifier.endOfDigits(from);
+        while (from < source.size() && isdigit(static_cast<unsigned char>(source[from]))) from++;
+        return from;
+    }
+
+    size_t endOfAlnum(size_t from) {
+        if (vectorized) return classifier.endOfAlnum(from);
+        while (from < source.size() && isalnum(static_cast<unsigned char>(source[from]))) from++;
+        return from;
+    }
+
+    std::string_view source;
     size_t position;
+    CharClassifier classifier;
+    bool vectorized;
+};
+
+// Storage for DIM'd arrays, aligned to a cache line so the vector kernels
+// below can use aligned loads and never split a line on the first element.
+template <typename T>
+struct AlignedAllocator {
+    using value_type = T;
+    static const size_t ALIGNMENT = 64;
+
+    AlignedAllocator() = default;
+    template <typename U>
+    AlignedAllocator(const AlignedAllocator<U>&) {}
+
+    T* allocate(size_t n) { return static_cast<T*>(::operator new(n * sizeof(T), std::align_val_t(ALIGNMENT))); }
+    void deallocate(T* p, size_t) { ::operator delete(p, std::align_val_t(ALIGNMENT)); }
+
+    bool operator==(const AlignedAllocator&) const { return true; }
+    bool operator!=(const AlignedAllocator&) const { return false; }
+};
+
+using IntArray = std::vector<int, AlignedAllocator<int>>;
+
+// Variables are resolved to dense slot indices at parse time; at run time their
+// values live in a flat frame indexed by slot. Arrays have slots of their own.
+struct Frame {
+    Frame() = default;
+    Frame(size_t slots, Value value) : values(slots, value) {}
+
+    Value& operator[](size_t slot) { return values[slot]; }
+    const Value& operator[](size_t slot) const { return values[slot]; }
+    size_t size() const { return values.size(); }
+    void resize(size_t slots, Value value) { values.resize(slots, value); }
+    Value* data() { return values.data(); }
+    const Value* data() const { return values.data(); }
+
+    std::vector<Value> values;
+    std::vector<IntArray> arrays;
+};
+
+// Whole-array arithmetic (A = B + C, A = A * 3, SUM(A)), eight lanes at a
+// time with AVX2 where the CPU has it. Array elements are 32-bit integers; a
+// kernel returns true if any element overflowed, and SUM adds in 64 bits.
+enum ArrayOperands {
+    ARRAY_ARRAY,   // left[i] op right[i]
+    ARRAY_SCALAR,  // left[i] op scalar
+    SCALAR_ARRAY   // scalar op right[i]
+};
+
+using ArrayKernel = bool (*)(int* out, const int* left, const int* right, int scalar, size_t n);
+
+struct ArrayKernels {
+    ArrayKernel apply[3][3]; // [PLUS, MINUS, MULTIPLY][ArrayOperands]
+    int64_t (*sum)(const int* values, size_t n);
+};
+
+// Each operation in one lane: the wrapped result, with overflow (in the sign
+// bit of the vector version's mask lanes).
+struct AddLanes {
+    static int scalar(int a, int b, bool& overflow) {
+        int64_t wide = int64_t(a) + b;
+        overflow |= wide != static_cast<int>(wide);
+        return static_cast<int>(wide);
+    }
+#if BASIC_X86_SIMD
+    __attribute__((target("avx2"))) static __m256i vector(__m256i a, __m256i b, __m256i& overflow) {
+        __m256i sum = _mm256_add_epi32(a, b);
+        overflow = _mm256_or_si256(overflow, _mm256_and_si256(_mm256_xor_si256(a, sum), _mm256_xor_si256(b, sum)));
+        return sum;
+    }
+#endif
+};
+struct SubLanes {
+    static int scalar(int a, int b, bool& overflow) {
+        int64_t wide = int64_t(a) - b;
+        overflow |= wide != static_cast<int>(wide);
+        return static_cast<int>(wide);
+    }
+#if BASIC_X86_SIMD
+    __attribute__((target("avx2"))) static __m256i vector(__m256i a, __m256i b, __m256i& overflow) {
+        __m256i difference = _mm256_sub_epi32(a, b);
+        overflow = _mm256_or_si256(overflow, _mm256_and_si256(_mm256_xor_si256(a, b), _mm256_xor_si256(a, difference)));
+        return difference;
+    }
+#endif
+};
+struct MulLanes {
+    static int scalar(int a, int b, bool& overflow) {
+        int64_t wide = int64_t(a) * b;
+        overflow |= wide != static_cast<int>(wide);
+        return static_cast<int>(wide);
+    }
+#if BASIC_X86_SIMD
+    // Full 64-bit products of the even and odd lanes; a product fits when its
+    // high half is the sign extension of its low half.
+    __attribute__((target("avx2"))) static __m256i vector(__m256i a, __m256i b, __m256i& overflow) {
+        __m256i even = _mm256_mul_epi32(a, b);
+        __m256i odd = _mm256_mul_epi32(_mm256_srli_epi64(a, 32), _mm256_srli_epi64(b, 32));
+        __m256i badEven = _mm256_xor_si256(even, _mm256_slli_epi64(_mm256_srai_epi32(even, 31), 32));
+        __m256i badOdd = _mm256_xor_si256(odd, _mm256_slli_epi64(_mm256_srai_epi32(odd, 31), 32));
+        __m256i highHalves = _mm256_set1_epi64x(int64_t(0xFFFFFFFF00000000ULL));
+        __m256i bad = _mm256_and_si256(_mm256_or_si256(badEven, badOdd), highHalves);
+        // Any bit set in a high half marks that pair; fold it into the sign bits.
+        overflow = _mm256_or_si256(overflow, _mm256_cmpeq_epi32(_mm256_cmpeq_epi32(bad, _mm256_setzero_si256()),
+                                                                _mm256_setzero_si256()));
+        return _mm256_blend_epi32(even, _mm256_slli_epi64(odd, 32), 0xAA);
+    }
+#endif
+};
+
+template <typename Lanes, ArrayOperands Operands>
+bool arrayKernelScalar(int* out, const int* left, const int* right, int scalar, size_t n) {
+    bool overflow = false;
+    for (size_t i = 0; i < n; i++) {
+        int a = Operands == SCALAR_ARRAY ? scalar : left[i];
+        int b = Operands == ARRAY_SCALAR ? scalar : right[i];
+        out[i] = Lanes::scalar(a, b, overflow);
+    }
+    return overflow;
+}
+
+int64_t arraySumScalar(const int* values, size_t n) {
+    int64_t sum = 0;
+    for (size_t i = 0; i < n; i++) sum += values[i];
+    return sum;
+}
+
+const ArrayKernels SCALAR_ARRAY_KERNELS = {
+    {{&arrayKernelScalar<AddLanes, ARRAY_ARRAY>, &arrayKernelScalar<AddLanes, ARRAY_SCALAR>, &arrayKernelScalar<AddLanes, SCALAR_ARRAY>},
+     {&arrayKernelScalar<SubLanes, ARRAY_ARRAY>, &arrayKernelScalar<SubLanes, ARRAY_SCALAR>, &arrayKernelScalar<SubLanes, SCALAR_ARRAY>},
+     {&arrayKernelScalar<MulLanes, ARRAY_ARRAY>, &arrayKernelScalar<MulLanes, ARRAY_SCALAR>, &arrayKernelScalar<MulLanes, SCALAR_ARRAY>}},
+    &arraySumScalar
+};
+
+#if BASIC_X86_SIMD
+// Arrays are 64-byte aligned, so every full group of eight lanes is too.
+template <typename Lanes, ArrayOperands Operands>
+__attribute__((target("avx2"))) bool arrayKernelAvx2(int* out, const int* left, const int* right, int scalar, size_t n) {
+    __m256i broadcast = _mm256_set1_epi32(scalar);
+    __m256i overflowLanes = _mm256_setzero_si256();
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256i a = Operands == SCALAR_ARRAY ? broadcast : _mm256_load_si256(reinterpret_cast<const __m256i*>(left + i));
+        __m256i b = Operands == ARRAY_SCALAR ? broadcast : _mm256_load_si256(reinterpret_cast<const __m256i*>(right + i));
+        _mm256_store_si256(reinterpret_cast<__m256i*>(out + i), Lanes::vector(a, b, overflowLanes));
+    }
+    bool overflow = _mm256_movemask_ps(_mm256_castsi256_ps(overflowLanes)) != 0;
+    for (; i < n; i++) {
+        int a = Operands == SCALAR_ARRAY ? scalar : left[i];
+        int b = Operands == ARRAY_SCALAR ? scalar : right[i];
+        out[i] = Lanes::scalar(a, b, overflow);
+    }
+    return overflow;
+}
+
+// Widens to 64-bit lanes, which cannot overflow for any array DIM allows.
+__attribute__((target("avx2"))) int64_t arraySumAvx2(const int* values, size_t n) {
+    __m256i low = _mm256_setzero_si256(), high = _mm256_setzero_si256();
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256i lanes = _mm256_load_si256(reinterpret_cast<const __m256i*>(values + i));
+        low = _mm256_add_epi64(low, _mm256_cvtepi32_epi64(_mm256_castsi256_si128(lanes)));
+        high = _mm256_add_epi64(high, _mm256_cvtepi32_epi64(_mm256_extracti128_si256(lanes, 1)));
+    }
+    __m256i sums = _mm256_add_epi64(low, high);
+    __m128i half = _mm_add_epi64(_mm256_castsi256_si128(sums), _mm256_extracti128_si256(sums, 1));
+    int64_t sum = _mm_cvtsi128_si64(half) + _mm_extract_epi64(half, 1);
+    for (; i < n; i++) sum += values[i];
+    return sum;
+}
+
+const ArrayKernels AVX2_ARRAY_KERNELS = {
+    {{&arrayKernelAvx2<AddLanes, ARRAY_ARRAY>, &arrayKernelAvx2<AddLanes, ARRAY_SCALAR>, &arrayKernelAvx2<AddLanes, SCALAR_ARRAY>},
+     {&arrayKernelAvx2<SubLanes, ARRAY_ARRAY>, &arrayKernelAvx2<SubLanes, ARRAY_SCALAR>, &arrayKernelAvx2<SubLanes, SCALAR_ARRAY>},
+     {&arrayKernelAvx2<MulLanes, ARRAY_ARRAY>, &arrayKernelAvx2<MulLanes, ARRAY_SCALAR>, &arrayKernelAvx2<MulLanes, SCALAR_ARRAY>}},
+    &arraySumAvx2
+};
+#endif
+
+// The fastest array kernels this CPU supports. SSE2 has no 32-bit multiply,
+// so CPUs without AVX2 use the scalar loops.
+const ArrayKernels& bestArrayKernels() {
+#if BASIC_X86_SIMD
+    static const ArrayKernels* best = [] {
+        __builtin_cpu_init();
+        return __builtin_cpu_supports("avx2") ? &AVX2_ARRAY_KERNELS : &SCALAR_ARRAY_KERNELS;
+    }();
+    return *best;
+#else
+    return SCALAR_ARRAY_KERNELS;
+#endif
+}
+
+// The slot map is keyed by views into the stored names (a deque never moves
+// its elements), so resolving a token needs no temporary string.
+class SymbolTable {
+public:
+    SymbolTable() = default;
+    SymbolTable(const SymbolTable&) = delete;
+    SymbolTable& operator=(const SymbolTable&) = delete;
+    SymbolTable(SymbolTable&&) = default;
+    SymbolTable& operator=(SymbolTable&&) = default;
+
+    int resolve(std::string_view name) {
+        auto it = slots.find(name);
+        if (it != slots.end()) {
+            return it->second;
+        }
+        int slot = static_cast<int>(names.size());
+        names.emplace_back(name);
+        slots.emplace(names.back(), slot);
+        return slot;
+    }
+
+    // A slot no name resolves to, for interpreter bookkeeping such as FOR limits.
+    int temporary() {
+        names.emplace_back();
+        return static_cast<int>(names.size() - 1);
+    }
+
+    size_t size() const { return names.size(); }
+    const std::string& name(int slot) const { return names[slot]; }
+
+    // Arrays are named by DIM and have slots of their own, so A and A(i)
+    // are different things.
+    int declareArray(std::string_view name) {
+        auto it = arraySlots.find(name);
+        if (it != arraySlots.end()) {
+            return it->second;
+        }
+        int array = static_cast<int>(arrayNames.size());
+        arrayNames.emplace_back(name);
+        arraySlots.emplace(arrayNames.back(), array);
+        return array;
+    }
+
+    // The array's slot, or -1 if no DIM seen so far names it.
+    int findArray(std::string_view name) const {
+        auto it = arraySlots.find(name);
+        return it != arraySlots.end() ? it->second : -1;
+    }
+
+    size_t arrayCount() const { return arrayNames.size(); }
+    const std::string& arrayName(int array) const { return arrayNames[array]; }
+
+    // Name-based view of a frame, only meant for debug dumps.
+    std::unordered_map<std::string, Value> dump(const Frame& frame) const {
+        std::unordered_map<std::string, Value> variables;
+        for (size_t slot = 0; slot < names.size() && slot < frame.size(); slot++) {
+            if (names[slot].empty()) continue;
+            variables[names[slot]] = frame[slot];
+        }
+        return variables;
+    }
+
+private:
+    std::unordered_map<std::string_view, int> slots;
+    std::deque<std::string> names;
+    std::unordered_map<std::string_view, int> arraySlots;
+    std::deque<std::string> arrayNames;
+};
+
+// Abstract Syntax Tree nodes. The kind tag lets passes over the tree (such as
+// the bytecode compiler) dispatch on node type without a virtual per pass.
+enum NodeKind {
+    NUMBER_NODE,
+    VARIABLE_NODE,
+    BINARY_OP_NODE,
+    ASSIGNMENT_NODE,
+    PRINT_NODE,
+    INPUT_NODE,
+    IF_ELSE_NODE,
+    GOTO_NODE,
+    GOSUB_NODE,
+    RETURN_NODE,
+    END_NODE,
+    FOR_NODE,
+    NEXT_NODE,
+    WHILE_NODE,
+    WEND_NODE,
+    DIM_NODE,
+    ARRAY_ELEMENT_NODE,
+    ARRAY_STORE_NODE,
+    ARRAY_OP_NODE,
+    ARRAY_SUM_NODE,
+    SAVE_NODE,
+    LOAD_NODE,
+    FLAT_EXPRESSION_NODE
 };
 
-// Abstract Syntax Tree nodes
 struct ASTNode {
+    const NodeKind kind;
+    explicit ASTNode(NodeKind kind) : kind(kind) {}
     virtual ~ASTNode() = default;
-    virtual int evaluate(std::unordered_map<std::string, int>& variables) = 0;
+    virtual Value evaluate(Frame& frame) = 0;
 };
 
 struct NumberNode : public ASTNode {
-    int value;
-    explicit NumberNode(int value) : value(value) {}
-    int evaluate(std::unordered_map<std::string, int>&) override {
+    Value value;
+    explicit NumberNode(Value value) : ASTNode(NUMBER_NODE), value(value) {}
+    Value evaluate(Frame&) override {
         return value;
     }
 };
 
 struct VariableNode : public ASTNode {
-    std::string name;
-    explicit VariableNode(const std::string& name) : name(name) {}
-    int evaluate(std::unordered_map<std::string, int>& variables) override {
-        return variables[name];
+    int slot;
+    explicit VariableNode(int slot) : ASTNode(VARIABLE_NODE), slot(slot) {}
+    Value evaluate(Frame& frame) override {
+        return frame[slot];
+    }
+};
+
+// 64-bit integer arithmetic that reports overflow instead of wrapping.
+inline bool addOverflows(int64_t a, int64_t b, int64_t& result) {
+#if defined(__GNUC__) || defined(__clang__)
+    return __builtin_add_overflow(a, b, &result);
+#else
+    if ((b > 0 && a > INT64_MAX - b) || (b < 0 && a < INT64_MIN - b)) return true;
+    result = a + b;
+    return false;
+#endif
+}
+
+inline bool subOverflows(int64_t a, int64_t b, int64_t& result) {
+#if defined(__GNUC__) || defined(__clang__)
+    return __builtin_sub_overflow(a, b, &result);
+#else
+    if ((b < 0 && a > INT64_MAX + b) || (b > 0 && a < INT64_MIN + b)) return true;
+    result = a - b;
+    return false;
+#endif
+}
+
+inline bool mulOverflows(int64_t a, int64_t b, int64_t& result) {
+#if defined(__GNUC__) || defined(__clang__)
+    return __builtin_mul_overflow(a, b, &result);
+#else
+    bool overflow = a > 0 ? (b > 0 ? a > INT64_MAX / b : b < INT64_MIN / a)
+                          : (b > 0 ? a < INT64_MIN / b : a != 0 && b < INT64_MAX / a);
+    if (overflow) return true;
+    result = a * b;
+    return false;
+#endif
+}
+
+// Keeps the rarely taken floating-point paths out of the integer fast paths
+// the interpreters inline.
+#if defined(__GNUC__) || defined(__clang__)
+#define BASIC_COLD __attribute__((noinline, cold))
+#else
+#define BASIC_COLD
+#endif
+
+// Applies an operator struct below. When both operands are integers the
+// result is an integer, unless it overflows: then it is computed again in
+// floating point.
+template <class Op>
+inline Value applyOp(Value a, Value b) {
+    int64_t result;
+    if ((a.tag | b.tag) == Value::INT && Op::integer(a.i, b.i, result)) return result;
+    return Op::real(a, b);
+}
+
+// The same, leaving the result in a. An integer result only rewrites the
+// payload, which keeps the VM's stack updates to a single store.
+template <class Op>
+inline void updateOp(Value& a, Value b) {
+    int64_t result;
+    if ((a.tag | b.tag) == Value::INT && Op::integer(a.i, b.i, result)) {
+        a.i = result;
+    } else {
+        a = Op::real(a, b);
+    }
+}
+
+// One struct per BASIC operator, so OperatorNode can apply it without a
+// switch. integer() returns false when the integer result would overflow.
+struct AddOp {
+    static const TokenType TOKEN = PLUS;
+    static bool integer(int64_t a, int64_t b, int64_t& result) { return !addOverflows(a, b, result); }
+    BASIC_COLD static Value real(Value a, Value b) { return Value::real(a.toDouble() + b.toDouble()); }
+    static Value apply(Value a, Value b) { return applyOp<AddOp>(a, b); }
+};
+struct SubOp {
+    static const TokenType TOKEN = MINUS;
+    static bool integer(int64_t a, int64_t b, int64_t& result) { return !subOverflows(a, b, result); }
+    BASIC_COLD static Value real(Value a, Value b) { return Value::real(a.toDouble() - b.toDouble()); }
+    static Value apply(Value a, Value b) { return applyOp<SubOp>(a, b); }
+};
+struct MulOp {
+    static const TokenType TOKEN = MULTIPLY;
+    static bool integer(int64_t a, int64_t b, int64_t& result) { return !mulOverflows(a, b, result); }
+    BASIC_COLD static Value real(Value a, Value b) { return Value::real(a.toDouble() * b.toDouble()); }
+    static Value apply(Value a, Value b) { return applyOp<MulOp>(a, b); }
+};
+// Integer division truncates, and traps on a zero divisor as it always has.
+struct DivOp {
+    static const TokenType TOKEN = DIVIDE;
+    static bool integer(int64_t a, int64_t b, int64_t& result) {
+        if (b == -1 && a == INT64_MIN) return false;
+        result = a / b;
+        return true;
+    }
+    BASIC_COLD static Value real(Value a, Value b) { return Value::real(a.toDouble() / b.toDouble()); }
+    static Value apply(Value a, Value b) { return applyOp<DivOp>(a, b); }
+};
+struct ModOp {
+    static const TokenType TOKEN = MOD;
+    static bool integer(int64_t a, int64_t b, int64_t& result) {
+        result = b == -1 ? 0 : a % b;
+        return true;
+    }
+    BASIC_COLD static Value real(Value a, Value b) { return Value::real(std::fmod(a.toDouble(), b.toDouble())); }
+    static Value apply(Value a, Value b) { return applyOp<ModOp>(a, b); }
+};
+struct EqOp {
+    static const TokenType TOKEN = EQUAL;
+    static bool integer(int64_t a, int64_t b, int64_t& result) {
+        result = a == b;
+        return true;
+    }
+    BASIC_COLD static Value real(Value a, Value b) { return int64_t(a.toDouble() == b.toDouble()); }
+    static Value apply(Value a, Value b) { return applyOp<EqOp>(a, b); }
+};
+struct NeOp {
+    static const TokenType TOKEN = NOT_EQUAL;
+    static bool integer(int64_t a, int64_t b, int64_t& result) {
+        result = a != b;
+        return true;
+    }
+    BASIC_COLD static Value real(Value a, Value b) { return int64_t(a.toDouble() != b.toDouble()); }
+    static Value apply(Value a, Value b) { return applyOp<NeOp>(a, b); }
+};
+struct LtOp {
+    static const TokenType TOKEN = LESS;
+    static bool integer(int64_t a, int64_t b, int64_t& result) {
+        result = a < b;
+        return true;
+    }
+    BASIC_COLD static Value real(Value a, Value b) { return int64_t(a.toDouble() < b.toDouble()); }
+    static Value apply(Value a, Value b) { return applyOp<LtOp>(a, b); }
+};
+struct GtOp {
+    static const TokenType TOKEN = GREATER;
+    static bool integer(int64_t a, int64_t b, int64_t& result) {
+        result = a > b;
+        return true;
+    }
+    BASIC_COLD static Value real(Value a, Value b) { return int64_t(a.toDouble() > b.toDouble()); }
+    static Value apply(Value a, Value b) { return applyOp<GtOp>(a, b); }
+};
+struct LeOp {
+    static const TokenType TOKEN = LESS_EQUAL;
+    static bool integer(int64_t a, int64_t b, int64_t& result) {
+        result = a <= b;
+        return true;
+    }
+    BASIC_COLD static Value real(Value a, Value b) { return int64_t(a.toDouble() <= b.toDouble()); }
+    static Value apply(Value a, Value b) { return applyOp<LeOp>(a, b); }
+};
+struct GeOp {
+    static const TokenType TOKEN = GREATER_EQUAL;
+    static bool integer(int64_t a, int64_t b, int64_t& result) {
+        result = a >= b;
+        return true;
     }
+    BASIC_COLD static Value real(Value a, Value b) { return int64_t(a.toDouble() >= b.toDouble()); }
+    static Value apply(Value a, Value b) { return applyOp<GeOp>(a, b); }
 };
+// AND and OR are logical: 1 or 0 from the truth of both operands, which are
+// always both evaluated.
+struct AndOp {
+    static const TokenType TOKEN = AND;
+    static bool integer(int64_t a, int64_t b, int64_t& result) {
+        result = a != 0 && b != 0;
+        return true;
+    }
+    BASIC_COLD static Value real(Value a, Value b) { return int64_t(a.isTrue() && b.isTrue()); }
+    static Value apply(Value a, Value b) { return applyOp<AndOp>(a, b); }
+};
+struct OrOp {
+    static const TokenType TOKEN = OR;
+    static bool integer(int64_t a, int64_t b, int64_t& result) {
+        result = a != 0 || b != 0;
+        return true;
+    }
+    BASIC_COLD static Value real(Value a, Value b) { return int64_t(a.isTrue() || b.isTrue()); }
+    static Value apply(Value a, Value b) { return applyOp<OrOp>(a, b); }
+};
+
+// a <= b, comparing integers exactly.
+inline bool lessOrEqual(Value a, Value b) {
+    return (a.tag | b.tag) == Value::INT ? a.i <= b.i : a.toDouble() <= b.toDouble();
+}
+
+// The result of a binary operator on two values; 0 for a token that is not one.
+inline Value applyBinary(TokenType op, Value a, Value b) {
+    switch (op) {
+        case MOD: return ModOp::apply(a, b);
+        case PLUS: return AddOp::apply(a, b);
+        case MINUS: return SubOp::apply(a, b);
+        case MULTIPLY: return MulOp::apply(a, b);
+        case DIVIDE: return DivOp::apply(a, b);
+        case EQUAL: return EqOp::apply(a, b); // Handle equality check
+        case NOT_EQUAL: return NeOp::apply(a, b);
+        case LESS: return LtOp::apply(a, b);
+        case GREATER: return GtOp::apply(a, b);
+        case LESS_EQUAL: return LeOp::apply(a, b);
+        case GREATER_EQUAL: return GeOp::apply(a, b);
+        case AND: return AndOp::apply(a, b);
+        case OR: return OrOp::apply(a, b);
+        default: return 0;
+    }
+}
+
+// How tightly each binary operator binds in the parser; 0 for a token that
+// is not one. All of them are left-associative.
+inline int precedence(TokenType type) {
+    switch (type) {
+        case OR: return 1;
+        case AND: return 2;
+        case EQUAL: case NOT_EQUAL: case LESS: case GREATER: case LESS_EQUAL: case GREATER_EQUAL: return 3;
+        case PLUS: case MINUS: return 4;
+        case MULTIPLY: case DIVIDE: case MOD: return 5;
+        default: return 0;
+    }
+}
+
+// a = a op b, for the operators applyBinary() knows; anything else leaves 0.
+inline void updateBinary(TokenType op, Value& a, Value b) {
+    switch (op) {
+        case PLUS: updateOp<AddOp>(a, b); break;
+        case MINUS: updateOp<SubOp>(a, b); break;
+        case MULTIPLY: updateOp<MulOp>(a, b); break;
+        case DIVIDE: updateOp<DivOp>(a, b); break;
+        case MOD: updateOp<ModOp>(a, b); break;
+        case EQUAL: updateOp<EqOp>(a, b); break;
+        case NOT_EQUAL: updateOp<NeOp>(a, b); break;
+        case LESS: updateOp<LtOp>(a, b); break;
+        case GREATER: updateOp<GtOp>(a, b); break;
+        case LESS_EQUAL: updateOp<LeOp>(a, b); break;
+        case GREATER_EQUAL: updateOp<GeOp>(a, b); break;
+        case AND: updateOp<AndOp>(a, b); break;
+        case OR: updateOp<OrOp>(a, b); break;
+        default: a = 0; break;
+    }
+}
 
 struct BinaryOpNode : public ASTNode {
+    TokenType op; // First, so it packs next to kind
     std::unique_ptr<ASTNode> left, right;
-    TokenType op;
     BinaryOpNode(std::unique_ptr<ASTNode> left, std::unique_ptr<ASTNode> right, TokenType op)
-        : left(std::move(left)), right(std::move(right)), op(op) {}
-    int evaluate(std::unordered_map<std::string, int>& variables) override {
-        int leftVal = left->evaluate(variables);
-        int rightVal = right->evaluate(variables);
-        switch (op) {
-            case MOD: return leftVal % rightVal;
-            case PLUS: return leftVal + rightVal;
-            case MINUS: return leftVal - rightVal;
-            case MULTIPLY: return leftVal * rightVal;
-            case DIVIDE: return leftVal / rightVal;
-            case EQUAL: return leftVal == rightVal ? 1 : 0; // Handle equality check
-            default: return 0;
+        : ASTNode(BINARY_OP_NODE), op(op), left(std::move(left)), right(std::move(right)) {}
+    // Frees deep chains with a loop; letting each node free its children
+    // would recurse once per level.
+    ~BinaryOpNode() override {
+        if (!isBinary(left) && !isBinary(right)) return;
+        std::vector<std::unique_ptr<ASTNode>> pending;
+        pending.push_back(std::move(left));
+        pending.push_back(std::move(right));
+        while (!pending.empty()) {
+            std::unique_ptr<ASTNode> node = std::move(pending.back());
+            pending.pop_back();
+            if (isBinary(node)) {
+                auto& binary = static_cast<BinaryOpNode&>(*node);
+                pending.push_back(std::move(binary.left));
+                pending.push_back(std::move(binary.right));
+            }
+        }
+    }
+    static bool isBinary(const std::unique_ptr<ASTNode>& node) { return node && node->kind == BINARY_OP_NODE; }
+    Value evaluate(Frame& frame) override {
+        Value leftVal = left->evaluate(frame);
+        Value rightVal = right->evaluate(frame);
+        return applyBinary(op, leftVal, rightVal);
+    }
+};
+
+// Where an OperatorNode's operands come from. Leaf operands (a variable's slot
+// or a constant) are copied out of the children when the node is built and
+// read directly, without a virtual call into the child.
+enum OperandShape {
+    ANY_ANY,     // Both children evaluated
+    ANY_CONST,   // expression op constant (a 32-bit integer)
+    VAR_CONST,   // variable op constant (a 32-bit integer)
+    VAR_VAR      // variable op variable
+};
+
+// A BinaryOpNode with its operator and operand shape fixed at compile time.
+// It keeps left, right and op, so passes over the tree treat it as any other
+// BinaryOpNode; but since it caches its leaves, a pass that replaces a child
+// must build a new node with makeBinaryOp() rather than edit this one.
+template <typename Op, OperandShape Shape>
+struct OperatorNode final : public BinaryOpNode {
+    int leftSlot = 0;
+    int rightLeaf = 0; // The right operand's slot (VAR_VAR) or value (*_CONST)
+    OperatorNode(std::unique_ptr<ASTNode> leftOperand, std::unique_ptr<ASTNode> rightOperand)
+        : BinaryOpNode(std::move(leftOperand), std::move(rightOperand), Op::TOKEN) {
+        if (Shape == VAR_CONST || Shape == VAR_VAR) leftSlot = static_cast<VariableNode&>(*left).slot;
+        if (Shape == VAR_VAR) rightLeaf = static_cast<VariableNode&>(*right).slot;
+        if (Shape == VAR_CONST || Shape == ANY_CONST) rightLeaf = static_cast<int>(static_cast<NumberNode&>(*right).value.i);
+    }
+    Value evaluate(Frame& frame) override {
+        if constexpr (Shape == VAR_CONST) {
+            return Op::apply(frame[leftSlot], int64_t(rightLeaf));
+        } else if constexpr (Shape == VAR_VAR) {
+            return Op::apply(frame[leftSlot], frame[rightLeaf]);
+        } else if constexpr (Shape == ANY_CONST) {
+            return Op::apply(left->evaluate(frame), int64_t(rightLeaf));
+        } else {
+            Value leftVal = left->evaluate(frame);
+            return Op::apply(leftVal, right->evaluate(frame));
         }
     }
 };
 
+// Whether a node is a constant an OperatorNode can keep in its int field.
+inline bool isSmallConstant(const ASTNode& node) {
+    if (node.kind != NUMBER_NODE) return false;
+    Value value = static_cast<const NumberNode&>(node).value;
+    return value.isInt() && value.i >= INT_MIN && value.i <= INT_MAX;
+}
+
+template <typename Op>
+std::unique_ptr<ASTNode> makeOperator(std::unique_ptr<ASTNode> left, std::unique_ptr<ASTNode> right) {
+    bool leftVariable = left->kind == VARIABLE_NODE;
+    if (isSmallConstant(*right)) {
+        if (leftVariable) return std::make_unique<OperatorNode<Op, VAR_CONST>>(std::move(left), std::move(right));
+        return std::make_unique<OperatorNode<Op, ANY_CONST>>(std::move(left), std::move(right));
+    }
+    if (leftVariable && right->kind == VARIABLE_NODE) {
+        return std::make_unique<OperatorNode<Op, VAR_VAR>>(std::move(left), std::move(right));
+    }
+    return std::make_unique<OperatorNode<Op, ANY_ANY>>(std::move(left), std::move(right));
+}
+
+// The specialized node for a binary operation.
+std::unique_ptr<ASTNode> makeBinaryOp(std::unique_ptr<ASTNode> left, std::unique_ptr<ASTNode> right, TokenType op) {
+    switch (op) {
+        case PLUS: return makeOperator<AddOp>(std::move(left), std::move(right));
+        case MINUS: return makeOperator<SubOp>(std::move(left), std::move(right));
+        case MULTIPLY: return makeOperator<MulOp>(std::move(left), std::move(right));
+        case DIVIDE: return makeOperator<DivOp>(std::move(left), std::move(right));
+        case MOD: return makeOperator<ModOp>(std::move(left), std::move(right));
+        case EQUAL: return makeOperator<EqOp>(std::move(left), std::move(right));
+        case NOT_EQUAL: return makeOperator<NeOp>(std::move(left), std::move(right));
+        case LESS: return makeOperator<LtOp>(std::move(left), std::move(right));
+        case GREATER: return makeOperator<GtOp>(std::move(left), std::move(right));
+        case LESS_EQUAL: return makeOperator<LeOp>(std::move(left), std::move(right));
+        case GREATER_EQUAL: return makeOperator<GeOp>(std::move(left), std::move(right));
+        case AND: return makeOperator<AndOp>(std::move(left), std::move(right));
+        case OR: return makeOperator<OrOp>(std::move(left), std::move(right));
+        default: return std::make_unique<BinaryOpNode>(std::move(left), std::move(right), op);
+    }
+}
+
 struct AssignmentNode : public ASTNode {
-    std::string variable;
+    int slot;
     std::unique_ptr<ASTNode> expression;
-    AssignmentNode(const std::string& variable, std::unique_ptr<ASTNode> expression)
-        : variable(variable), expression(std::move(expression)) {}
-    int evaluate(std::unordered_map<std::string, int>& variables) override {
-        int value = expression->evaluate(variables);
-        variables[variable] = value;
+    AssignmentNode(int slot, std::unique_ptr<ASTNode> expression)
+        : ASTNode(ASSIGNMENT_NODE), slot(slot), expression(std::move(expression)) {}
+    Value evaluate(Frame& frame) override {
+        Value value = expression->evaluate(frame);
+        frame[slot] = value;
         return value;
     }
 };
 
+// The e of x = x + e or x = e + x, or null. Such a statement adds e to x in
+// place (AccumulateNode, OP_INC and OP_ADD_TO).
+inline ASTNode* accumulatedAddend(const AssignmentNode& assignment) {
+    if (assignment.expression->kind != BINARY_OP_NODE) return nullptr;
+    const auto& binary = static_cast<const BinaryOpNode&>(*assignment.expression);
+    if (binary.op != PLUS) return nullptr;
+    auto isTarget = [&](const ASTNode& node) {
+        return node.kind == VARIABLE_NODE && static_cast<const VariableNode&>(node).slot == assignment.slot;
+    };
+    if (isTarget(*binary.left)) return binary.right.get();
+    if (isTarget(*binary.right)) return binary.left.get();
+    return nullptr;
+}
+
+// x = x + e, adding e to x's slot without evaluating x + e as a tree. Like
+// OperatorNode it keeps its expression, so passes still see an assignment,
+// but it caches the addend: build it last, with fuseStatement().
+template <OperandShape Shape>
+struct AccumulateNode final : public AssignmentNode {
+    ASTNode* addend;
+    int addendLeaf = 0; // The addend's slot (VAR_VAR) or value (ANY_CONST)
+    AccumulateNode(int slot, std::unique_ptr<ASTNode> expression, ASTNode& addend)
+        : AssignmentNode(slot, std::move(expression)), addend(&addend) {
+        if (Shape == VAR_VAR) addendLeaf = static_cast<const VariableNode&>(addend).slot;
+        if (Shape == ANY_CONST) addendLeaf = static_cast<int>(static_cast<const NumberNode&>(addend).value.i);
+    }
+    Value evaluate(Frame& frame) override {
+        if constexpr (Shape == ANY_CONST) {
+            updateOp<AddOp>(frame[slot], int64_t(addendLeaf));
+        } else if constexpr (Shape == VAR_VAR) {
+            updateOp<AddOp>(frame[slot], frame[addendLeaf]);
+        } else {
+            Value value = addend->evaluate(frame);
+            updateOp<AddOp>(frame[slot], value);
+        }
+        return frame[slot];
+    }
+};
+
 struct PrintNode : public ASTNode {
     std::unique_ptr<ASTNode> expression;
-    explicit PrintNode(std::unique_ptr<ASTNode> expression) : expression(std::move(expression)) {}
-    int evaluate(std::unordered_map<std::string, int>& variables) override {
-        int value = expression->evaluate(variables);
-        std::cout << value << std::endl;
-        return value;
+    int slot = -1; // For PRINT x, x's slot, read without evaluating; set by fuseStatement()
+    explicit PrintNode(std::unique_ptr<ASTNode> expression) : ASTNode(PRINT_NODE), expression(std::move(expression)) {}
+    // PRINT only runs through Program::execute(), which writes to the run's
+    // OutputSink; there is no second, unbuffered output path.
+    Value evaluate(Frame&) override {
+        assert(!"PRINT is executed by the Program, not evaluated");
+        return 0;
     }
 };
 
 struct InputNode : public ASTNode {
+    int slot;
     std::string variable;
-    explicit InputNode(const std::string& variable) : variable(variable) {}
-    int evaluate(std::unordered_map<std::string, int>& variables) override {
-        int value;
-        std::cout << "Enter value for " << variable << ": ";
-        std::cin >> value;
-        variables[variable] = value;
-        return value;
+    InputNode(int slot, const std::string& variable) : ASTNode(INPUT_NODE), slot(slot), variable(variable) {}
+    // Like PRINT, INPUT only runs through Program::execute(), which reads
+    // from the run's InputSource.
+    Value evaluate(Frame&) override {
+        assert(!"INPUT is executed by the Program, not evaluated");
+        return 0;
     }
 };
 
+// x == k the way EqOp compares, for a 64-bit integer k.
+inline bool equalsConstant(Value value, int64_t constant) {
+    return value.isInt() ? value.i == constant : value.d == static_cast<double>(constant);
+}
+
+// A condition of the form x == k, or x <> k or x - k (true exactly when
+// x != k), tested straight off x's slot.
+struct ConstantTest {
+    int slot = -1;          // -1: the condition has some other form
+    bool equal = false;     // Passes when x == k, rather than when x != k
+    int64_t constant = 0;
+
+    bool passes(const Frame& frame) const { return equalsConstant(frame[slot], constant) == equal; }
+};
+
+inline ConstantTest constantTest(const ASTNode& condition) {
+    ConstantTest test;
+    if (condition.kind != BINARY_OP_NODE) return test;
+    const auto& binary = static_cast<const BinaryOpNode&>(condition);
+    if ((binary.op != EQUAL && binary.op != NOT_EQUAL && binary.op != MINUS) || binary.left->kind != VARIABLE_NODE || binary.right->kind != NUMBER_NODE
+        || !static_cast<const NumberNode&>(*binary.right).value.isInt()) {
+        return test;
+    }
+    test.slot = static_cast<const VariableNode&>(*binary.left).slot;
+    test.equal = binary.op == EQUAL;
+    test.constant = static_cast<const NumberNode&>(*binary.right).value.i;
+    return test;
+}
+
 struct IfElseNode : public ASTNode {
     std::unique_ptr<ASTNode> condition;
     std::unique_ptr<ASTNode> thenBranch;
     std::unique_ptr<ASTNode> elseBranch;
+    ConstantTest test;  // The condition's fused form, if it has one; set by fuseStatement()
     IfElseNode(std::unique_ptr<ASTNode> condition, std::unique_ptr<ASTNode> thenBranch, std::unique_ptr<ASTNode> elseBranch)
-        : condition(std::move(condition)), thenBranch(std::move(thenBranch)), elseBranch(std::move(elseBranch)) {}
-    int evaluate(std::unordered_map<std::string, int>& variables) override {
-        if (condition->evaluate(variables)) {
-            return thenBranch->evaluate(variables);
-        } else if (elseBranch) {
-            return elseBranch->evaluate(variables);
-        }
+        : ASTNode(IF_ELSE_NODE), condition(std::move(condition)), thenBranch(std::move(thenBranch)), elseBranch(std::move(elseBranch)) {}
+    // A branch may be a PRINT, INPUT or jump, which only Program::execute()
+    // can carry out, so IF runs there too rather than dispatching from here.
+    Value evaluate(Frame&) override {
+        assert(!"IF is executed by the Program, not evaluated");
         return 0;
     }
 };
 
-class Parser {
-public:
-    explicit Parser(const std::vector<Token>& tokens) : tokens(tokens), position(0) {}
+// Control-flow statements. They only mark where execution goes next; the
+// Program's run loop interprets them. Jump targets are statement indices,
+// resolved once when the program is loaded.
+const size_t END_OF_PROGRAM = SIZE_MAX - 1;    // Where END and a stray RETURN go
+const size_t UNRESOLVED_TARGET = SIZE_MAX;     // A target not loaded yet
 
-    std::unique_ptr<ASTNode> parse() {
-        return parseStatement();
+// Puts a statement in its fused form where it has one: x = x + e becomes an
+// AccumulateNode, PRINT x and IF (x == k) note the slot they read. Runs after
+// every pass that rewrites expressions.
+std::unique_ptr<ASTNode> fuseStatement(std::unique_ptr<ASTNode> node) {
+    switch (node->kind) {
+        case ASSIGNMENT_NODE: {
+            auto& assignment = static_cast<AssignmentNode&>(*node);
+            ASTNode* addend = accumulatedAddend(assignment);
+            if (!addend) break;
+            if (isSmallConstant(*addend)) {
+                return std::make_unique<AccumulateNode<ANY_CONST>>(assignment.slot, std::move(assignment.expression), *addend);
+            }
+            if (addend->kind == VARIABLE_NODE) {
+                return std::make_unique<AccumulateNode<VAR_VAR>>(assignment.slot, std::move(assignment.expression), *addend);
+            }
+            return std::make_unique<AccumulateNode<ANY_ANY>>(assignment.slot, std::move(assignment.expression), *addend);
+        }
+        case PRINT_NODE: {
+            auto& print = static_cast<PrintNode&>(*node);
+            print.slot = print.expression->kind == VARIABLE_NODE ? static_cast<VariableNode&>(*print.expression).slot : -1;
+            break;
+        }
+        case IF_ELSE_NODE: {
+            auto& ifElse = static_cast<IfElseNode&>(*node);
+            ifElse.test = constantTest(*ifElse.condition);
+            ifElse.thenBranch = fuseStatement(std::move(ifElse.thenBranch));
+            if (ifElse.elseBranch) ifElse.elseBranch = fuseStatement(std::move(ifElse.elseBranch));
+            break;
+        }
+        default:
+            break;
     }
+    return node;
+}
 
-private:
-    std::unique_ptr<ASTNode> parseStatement() {
-        if (tokens[position].type == PRINT) {
-            position++;
-            auto expr = parseExpression();
-            return std::make_unique<PrintNode>(std::move(expr));
-        } else if (tokens[position].type == INPUT) {
-            position++;
-            if (tokens[position].type == IDENTIFIER) {
-                std::string varName = tokens[position].value;
-                position++;
-                return std::make_unique<InputNode>(varName);
-            }
-        } else if (tokens[position].type == IF) {
+struct ControlNode : public ASTNode {
+    explicit ControlNode(NodeKind kind) : ASTNode(kind) {}
+    Value evaluate(Frame&) override {
+        return 0;
+    }
+};
+
+struct GotoNode : public ControlNode {
+    int line;
+    size_t target = UNRESOLVED_TARGET;
+    GotoNode(NodeKind kind, int line) : ControlNode(kind), line(line) {}
+};
+
+// FOR counter = start TO limit [STEP step]. The limit and step are evaluated
+// once on entry and kept in hidden frame slots.
+struct ForNode : public ControlNode {
+    int slot;
+    std::unique_ptr<ASTNode> start, limit, step;
+    int limitSlot = -1, stepSlot = -1;
+    size_t exitTarget = UNRESOLVED_TARGET;
+    ForNode(int slot, std::unique_ptr<ASTNode> start, std::unique_ptr<ASTNode> limit, std::unique_ptr<ASTNode> step)
+        : ControlNode(FOR_NODE), slot(slot), start(std::move(start)), limit(std::move(limit)), step(std::move(step)) {}
+};
+
+struct NextNode : public ControlNode {
+    int slot; // -1 when NEXT names no variable
+    int limitSlot = -1, stepSlot = -1;
+    size_t bodyTarget = 0;
+    explicit NextNode(int slot) : ControlNode(NEXT_NODE), slot(slot) {}
+};
+
+struct WhileNode : public ControlNode {
+    std::unique_ptr<ASTNode> condition;
+    size_t exitTarget = UNRESOLVED_TARGET;
+    explicit WhileNode(std::unique_ptr<ASTNode> condition) : ControlNode(WHILE_NODE), condition(std::move(condition)) {}
+};
+
+struct WendNode : public ControlNode {
+    size_t loopTarget = 0;
+    WendNode() : ControlNode(WEND_NODE) {}
+};
+
+// Whether a FOR loop with this counter, limit and step runs another iteration.
+inline bool forContinues(Value counter, Value limit, Value step) {
+    bool up = step.isInt() ? step.i >= 0 : step.d >= 0;
+    return up ? lessOrEqual(counter, limit) : lessOrEqual(limit, counter);
+}
+
+// A fault that ends the run, such as an array index out of bounds. Array
+// reads can fault in the middle of any expression, so the tree-walker throws
+// this to the run loop, which reports it the way RETURN without GOSUB is
+// reported. The bytecode VM checks for faults in place instead.
+struct RuntimeError {
+    const char* message;
+};
+
+const char* const INDEX_OUT_OF_BOUNDS = "Array index out of bounds!";
+const char* const SIZE_MISMATCH = "Array size mismatch!";
+const char* const BAD_DIM = "Bad DIM size!";
+const char* const ARRAY_VALUE_RANGE = "Array value out of range!";
+const char* const ARRAY_OVERFLOW = "Array overflow!";
+
+// Elements one array may have.
+const int MAX_ARRAY_ELEMENTS = 1 << 26;
+
+// The array in a slot. An array no DIM has run for yet is empty.
+inline IntArray& arrayIn(Frame& frame, int array) {
+    if (static_cast<size_t>(array) >= frame.arrays.size()) {
+        frame.arrays.resize(array + 1);
+    }
+    return frame.arrays[array];
+}
+
+// The element at index, or null if the index is out of bounds (or not an
+// integer).
+inline int* arrayElement(Frame& frame, int array, Value index) {
+    IntArray& values = arrayIn(frame, array);
+    return index.isInt() && static_cast<uint64_t>(index.i) < values.size() ? &values[index.i] : nullptr;
+}
+
+// Whether a value can be stored in an array, whose elements are 32-bit integers.
+inline bool fitsElement(Value value) {
+    return value.isInt() && value.i >= INT_MIN && value.i <= INT_MAX;
+}
+
+// DIM array(last): indices 0..last, all zero. Returns an error message or null.
+inline const char* dimension(Frame& frame, int array, Value last) {
+    if (!last.isInt() || last.i < 0 || last.i >= MAX_ARRAY_ELEMENTS) {
+        return BAD_DIM;
+    }
+    IntArray& values = arrayIn(frame, array);
+    values.assign(static_cast<size_t>(last.i) + 1, 0);
+    return nullptr;
+}
+
+// target = left op right over whole arrays, where an operand is an array slot
+// or (when the slot is -1) a scalar. op is ASSIGN for a plain copy or fill,
+// which only uses left. Every array involved must have the target's size.
+// Returns an error message or null.
+inline const char* applyArrayOp(Frame& frame, int target, TokenType op, int leftArray, int rightArray,
+                                Value leftScalar, Value rightScalar) {
+    // Resized first, so the references below stay valid.
+    arrayIn(frame, std::max(target, std::max(leftArray, rightArray)));
+    IntArray& out = frame.arrays[target];
+    const IntArray* left = leftArray >= 0 ? &frame.arrays[leftArray] : nullptr;
+    const IntArray* right = op != ASSIGN && rightArray >= 0 ? &frame.arrays[rightArray] : nullptr;
+    if ((left && left->size() != out.size()) || (right && right->size() != out.size())) {
+        return SIZE_MISMATCH;
+    }
+    if ((!left && !fitsElement(leftScalar)) || (op != ASSIGN && !right && !fitsElement(rightScalar))) {
+        return ARRAY_VALUE_RANGE;
+    }
+    if (op == ASSIGN) {
+        if (!left) {
+            std::fill(out.begin(), out.end(), static_cast<int>(leftScalar.i));
+        } else if (left != &out) {
+            std::copy(left->begin(), left->end(), out.begin());
+        }
+        return nullptr;
+    }
+    int row = op == PLUS ? 0 : op == MINUS ? 1 : 2;
+    const ArrayKernels& kernels = bestArrayKernels();
+    bool overflow = false;
+    if (left && right) {
+        overflow = kernels.apply[row][ARRAY_ARRAY](out.data(), left->data(), right->data(), 0, out.size());
+    } else if (left) {
+        overflow = kernels.apply[row][ARRAY_SCALAR](out.data(), left->data(), nullptr, static_cast<int>(rightScalar.i), out.size());
+    } else if (right) {
+        overflow = kernels.apply[row][SCALAR_ARRAY](out.data(), nullptr, right->data(), static_cast<int>(leftScalar.i), out.size());
+    }
+    return overflow ? ARRAY_OVERFLOW : nullptr;
+}
+
+// DIM name(last)
+struct DimNode : public ASTNode {
+    int array;
+    std::unique_ptr<ASTNode> last;
+    DimNode(int array, std::unique_ptr<ASTNode> last) : ASTNode(DIM_NODE), array(array), last(std::move(last)) {}
+    Value evaluate(Frame& frame) override {
+        if (const char* error = dimension(frame, array, last->evaluate(frame))) throw RuntimeError{error};
+        return 0;
+    }
+};
+
+// name(index) in an expression.
+struct ArrayElementNode : public ASTNode {
+    int array;
+    std::unique_ptr<ASTNode> index;
+    ArrayElementNode(int array, std::unique_ptr<ASTNode> index)
+        : ASTNode(ARRAY_ELEMENT_NODE), array(array), index(std::move(index)) {}
+    Value evaluate(Frame& frame) override {
+        int* element = arrayElement(frame, array, index->evaluate(frame));
+        if (!element) throw RuntimeError{INDEX_OUT_OF_BOUNDS};
+        return int64_t(*element);
+    }
+};
+
+// name(index) = expression
+struct ArrayStoreNode : public ASTNode {
+    int array;
+    std::unique_ptr<ASTNode> index, expression;
+    ArrayStoreNode(int array, std::unique_ptr<ASTNode> index, std::unique_ptr<ASTNode> expression)
+        : ASTNode(ARRAY_STORE_NODE), array(array), index(std::move(index)), expression(std::move(expression)) {}
+    Value evaluate(Frame& frame) override {
+        Value position = index->evaluate(frame);
+        Value value = expression->evaluate(frame);
+        int* element = arrayElement(frame, array, position);
+        if (!element) throw RuntimeError{INDEX_OUT_OF_BOUNDS};
+        if (!fitsElement(value)) throw RuntimeError{ARRAY_VALUE_RANGE};
+        *element = static_cast<int>(value.i);
+        return value;
+    }
+};
+
+// One side of a whole-array statement: a whole array, or a scalar expression
+// when array is -1.
+struct ArrayOperand {
+    int array = -1;
+    std::unique_ptr<ASTNode> scalar;
+};
+
+// name = left [op right] over every element; see applyArrayOp().
+struct ArrayOpNode : public ASTNode {
+    int target;
+    TokenType op;
+    ArrayOperand left, right;
+    ArrayOpNode(int target, TokenType op, ArrayOperand left, ArrayOperand right)
+        : ASTNode(ARRAY_OP_NODE), target(target), op(op), left(std::move(left)), right(std::move(right)) {}
+    Value evaluate(Frame& frame) override {
+        Value leftValue = left.scalar ? left.scalar->evaluate(frame) : 0;
+        Value rightValue = right.scalar ? right.scalar->evaluate(frame) : 0;
+        if (const char* error = applyArrayOp(frame, target, op, left.array, right.array, leftValue, rightValue)) {
+            throw RuntimeError{error};
+        }
+        return 0;
+    }
+};
+
+// SUM(name): the elements' total.
+struct ArraySumNode : public ASTNode {
+    int array;
+    explicit ArraySumNode(int array) : ASTNode(ARRAY_SUM_NODE), array(array) {}
+    Value evaluate(Frame& frame) override {
+        const IntArray& values = arrayIn(frame, array);
+        return bestArrayKernels().sum(values.data(), values.size());
+    }
+};
+
+// Trees deeper than this are evaluated by a FlatExpressionNode instead, so
+// neither evaluating them nor any pass over them recurses that deep.
+const size_t MAX_TREE_DEPTH = 1000;
+
+// One step of a FlatExpressionNode, working on its value stack.
+struct FlatStep {
+    enum Code : uint8_t {
+        CONSTANT,          // push constant
+        VARIABLE,          // push frame[slot]
+        APPLY,             // right = pop; top = top op right
+        APPLY_CONSTANT,    // top = top op constant
+        APPLY_VARIABLE,    // top = top op frame[slot]
+        ELEMENT,           // top = array slot's element at index top
+        SUM                // push SUM(array slot)
+    };
+    Code code;
+    TokenType op;
+    int slot;
+    Value constant;
+};
+
+// An expression tree flattened into postorder: a loop over its steps with a
+// value stack on the heap instead of one native call per level. Leaf right
+// operands fold into the operator step, so a left-leaning chain such as
+// 1 + 2 + ... + n keeps a single value on the stack.
+struct FlatExpressionNode : public ASTNode {
+    std::vector<FlatStep> steps;
+    std::vector<Value> stack;  // Sized for the deepest point of the steps
+    FlatExpressionNode() : ASTNode(FLAT_EXPRESSION_NODE) {}
+    Value evaluate(Frame& frame) override {
+        Value* top = stack.data() - 1;
+        for (const FlatStep& step : steps) {
+            switch (step.code) {
+                case FlatStep::CONSTANT:
+                    *++top = step.constant;
+                    break;
+                case FlatStep::VARIABLE:
+                    *++top = frame[step.slot];
+                    break;
+                case FlatStep::APPLY:
+                    top--;
+                    updateBinary(step.op, *top, top[1]);
+                    break;
+                case FlatStep::APPLY_CONSTANT:
+                    updateBinary(step.op, *top, step.constant);
+                    break;
+                case FlatStep::APPLY_VARIABLE:
+                    updateBinary(step.op, *top, frame[step.slot]);
+                    break;
+                case FlatStep::ELEMENT: {
+                    int* element = arrayElement(frame, step.slot, *top);
+                    if (!element) throw RuntimeError{INDEX_OUT_OF_BOUNDS};
+                    *top = int64_t(*element);
+                    break;
+                }
+                case FlatStep::SUM: {
+                    const IntArray& values = arrayIn(frame, step.slot);
+                    *++top = bestArrayKernels().sum(values.data(), values.size());
+                    break;
+                }
+            }
+        }
+        return *top;
+    }
+};
+
+// The expression's depth, measured without recursing.
+size_t treeDepth(const ASTNode& root) {
+    size_t deepest = 0;
+    std::vector<std::pair<const ASTNode*, size_t>> pending{{&root, 1}};
+    while (!pending.empty()) {
+        auto [node, depth] = pending.back();
+        pending.pop_back();
+        deepest = std::max(deepest, depth);
+        if (node->kind == BINARY_OP_NODE) {
+            const auto& binary = static_cast<const BinaryOpNode&>(*node);
+            pending.emplace_back(binary.left.get(), depth + 1);
+            pending.emplace_back(binary.right.get(), depth + 1);
+        } else if (node->kind == ARRAY_ELEMENT_NODE) {
+            pending.emplace_back(static_cast<const ArrayElementNode&>(*node).index.get(), depth + 1);
+        }
+    }
+    return deepest;
+}
+
+// The expression as a FlatExpressionNode, emitted by a postorder walk with
+// an explicit stack. Every expression node kind has a step.
+std::unique_ptr<ASTNode> flattenExpression(std::unique_ptr<ASTNode> root) {
+    auto flat = std::make_unique<FlatExpressionNode>();
+    std::vector<FlatStep>& steps = flat->steps;
+    size_t depth = 0, deepest = 0;
+    auto push = [&](FlatStep step) {
+        steps.push_back(step);
+        deepest = std::max(deepest, ++depth);
+    };
+    // (node, whether its operands have been emitted)
+    std::vector<std::pair<const ASTNode*, bool>> pending{{root.get(), false}};
+    while (!pending.empty()) {
+        auto [node, operandsDone] = pending.back();
+        pending.pop_back();
+        switch (node->kind) {
+            case NUMBER_NODE:
+                push({FlatStep::CONSTANT, INVALID, 0, static_cast<const NumberNode&>(*node).value});
+                break;
+            case VARIABLE_NODE:
+                push({FlatStep::VARIABLE, INVALID, static_cast<const VariableNode&>(*node).slot, 0});
+                break;
+            case ARRAY_SUM_NODE:
+                push({FlatStep::SUM, INVALID, static_cast<const ArraySumNode&>(*node).array, 0});
+                break;
+            case ARRAY_ELEMENT_NODE: {
+                const auto& element = static_cast<const ArrayElementNode&>(*node);
+                if (!operandsDone) {
+                    pending.emplace_back(node, true);
+                    pending.emplace_back(element.index.get(), false);
+                } else {
+                    steps.push_back({FlatStep::ELEMENT, INVALID, element.array, 0});
+                }
+                break;
+            }
+            case BINARY_OP_NODE: {
+                const auto& binary = static_cast<const BinaryOpNode&>(*node);
+                if (!operandsDone) {
+                    pending.emplace_back(node, true);
+                    pending.emplace_back(binary.right.get(), false);
+                    pending.emplace_back(binary.left.get(), false);
+                    break;
+                }
+                // A push just before the operator can only be a leaf right operand.
+                FlatStep& last = steps.back();
+                if (last.code == FlatStep::CONSTANT || last.code == FlatStep::VARIABLE) {
+                    last.code = last.code == FlatStep::CONSTANT ? FlatStep::APPLY_CONSTANT : FlatStep::APPLY_VARIABLE;
+                    last.op = binary.op;
+                } else {
+                    steps.push_back({FlatStep::APPLY, binary.op, 0, 0});
+                }
+                depth--;
+                break;
+            }
+            default:
+                break;
+        }
+    }
+    flat->stack.resize(deepest);
+    return flat;
+}
+
+// Flattens each of the statement's expressions deeper than MAX_TREE_DEPTH.
+void flattenDeepExpressions(ASTNode& statement) {
+    auto flatten = [](std::unique_ptr<ASTNode>& expression) {
+        if (expression && treeDepth(*expression) > MAX_TREE_DEPTH) expression = flattenExpression(std::move(expression));
+    };
+    switch (statement.kind) {
+        case ASSIGNMENT_NODE:
+            flatten(static_cast<AssignmentNode&>(statement).expression);
+            break;
+        case PRINT_NODE:
+            flatten(static_cast<PrintNode&>(statement).expression);
+            break;
+        case IF_ELSE_NODE: {
+            auto& ifElse = static_cast<IfElseNode&>(statement);
+            flatten(ifElse.condition);
+            flattenDeepExpressions(*ifElse.thenBranch);
+            if (ifElse.elseBranch) flattenDeepExpressions(*ifElse.elseBranch);
+            break;
+        }
+        case FOR_NODE: {
+            auto& loop = static_cast<ForNode&>(statement);
+            flatten(loop.start);
+            flatten(loop.limit);
+            flatten(loop.step);
+            break;
+        }
+        case WHILE_NODE:
+            flatten(static_cast<WhileNode&>(statement).condition);
+            break;
+        case DIM_NODE:
+            flatten(static_cast<DimNode&>(statement).last);
+            break;
+        case ARRAY_STORE_NODE: {
+            auto& store = static_cast<ArrayStoreNode&>(statement);
+            flatten(store.index);
+            flatten(store.expression);
+            break;
+        }
+        case ARRAY_OP_NODE: {
+            auto& arrayOp = static_cast<ArrayOpNode&>(statement);
+            flatten(arrayOp.left.scalar);
+            flatten(arrayOp.right.scalar);
+            break;
+        }
+        default:
+            break;
+    }
+}
+
+// Number of nodes in a statement's tree.
+size_t countNodes(const ASTNode& node) {
+    switch (node.kind) {
+        case BINARY_OP_NODE: {
+            auto& binary = static_cast<const BinaryOpNode&>(node);
+            return 1 + countNodes(*binary.left) + countNodes(*binary.right);
+        }
+        case ASSIGNMENT_NODE:
+            return 1 + countNodes(*static_cast<const AssignmentNode&>(node).expression);
+        case PRINT_NODE:
+            return 1 + countNodes(*static_cast<const PrintNode&>(node).expression);
+        case IF_ELSE_NODE: {
+            auto& ifElse = static_cast<const IfElseNode&>(node);
+            return 1 + countNodes(*ifElse.condition) + countNodes(*ifElse.thenBranch)
+                + (ifElse.elseBranch ? countNodes(*ifElse.elseBranch) : 0);
+        }
+        case FOR_NODE: {
+            auto& loop = static_cast<const ForNode&>(node);
+            return 1 + countNodes(*loop.start) + countNodes(*loop.limit) + (loop.step ? countNodes(*loop.step) : 0);
+        }
+        case WHILE_NODE:
+            return 1 + countNodes(*static_cast<const WhileNode&>(node).condition);
+        case DIM_NODE:
+            return 1 + countNodes(*static_cast<const DimNode&>(node).last);
+        case ARRAY_ELEMENT_NODE:
+            return 1 + countNodes(*static_cast<const ArrayElementNode&>(node).index);
+        case ARRAY_STORE_NODE: {
+            auto& store = static_cast<const ArrayStoreNode&>(node);
+            return 1 + countNodes(*store.index) + countNodes(*store.expression);
+        }
+        case ARRAY_OP_NODE: {
+            auto& arrayOp = static_cast<const ArrayOpNode&>(node);
+            return 1 + (arrayOp.left.scalar ? countNodes(*arrayOp.left.scalar) : 0)
+                + (arrayOp.right.scalar ? countNodes(*arrayOp.right.scalar) : 0);
+        }
+        case FLAT_EXPRESSION_NODE:
+            return static_cast<const FlatExpressionNode&>(node).steps.size();
+        default:
+            return 1;
+    }
+}
+
+class Parser {
+public:
+    Parser(const std::vector<Token>& tokens, SymbolTable& symbols) : tokens(tokens), symbols(symbols), position(0) {}
+
+    // A statement, optionally preceded by a line number (see lineNumber()).
+    std::unique_ptr<ASTNode> parse() {
+        if (isLineNumber(tokens[position])) {
+            label = static_cast<int>(tokens[position].number.i);
+            position++;
+        }
+        auto statement = parseStatement();
+        if (tokens[position].type != END) {
+            return nullptr; // Trailing tokens after a complete statement
+        }
+        if (statement && tokens.size() > MAX_TREE_DEPTH) {
+            flattenDeepExpressions(*statement);
+        }
+        return statement;
+    }
+
+    // The line number the parsed line started with, or -1 if it had none.
+    int lineNumber() const { return label; }
+
+private:
+    // Line numbers are integer literals small enough for an int.
+    static bool isLineNumber(const Token& token) {
+        return token.type == NUMBER && token.number.isInt() && token.number.i <= INT_MAX;
+    }
+
+    // Loop statements only make sense on a line of their own, not inside IF.
+    static bool isLoopStatement(const ASTNode& node) {
+        return node.kind == FOR_NODE || node.kind == NEXT_NODE || node.kind == WHILE_NODE || node.kind == WEND_NODE;
+    }
+
+    std::unique_ptr<ASTNode> parseStatement() {
+        if (tokens[position].type == PRINT) {
+            position++;
+            auto expr = parseExpression();
+            if (!expr) return nullptr;
+            return std::make_unique<PrintNode>(std::move(expr));
+        } else if (tokens[position].type == INPUT) {
+            position++;
+            if (tokens[position].type == IDENTIFIER) {
+                std::string_view varName = tokens[position].text;
+                position++;
+                return std::make_unique<InputNode>(symbols.resolve(varName), std::string(varName));
+            }
+        } else if (tokens[position].type == IF) {
             position++;
             if (tokens[position].type == LEFT_PAREN) {
                 position++;
                 auto condition = parseExpression();
-                if (tokens[position].type == RIGHT_PAREN) {
+                if (condition && tokens[position].type == RIGHT_PAREN) {
                     position++;
                     auto thenBranch = parseStatement();
+                    if (!thenBranch || isLoopStatement(*thenBranch)) return nullptr;
                     std::unique_ptr<ASTNode> elseBranch = nullptr;
                     if (tokens[position].type == ELSE) {
                         position++;
                         elseBranch = parseStatement();
+                        if (!elseBranch || isLoopStatement(*elseBranch)) return nullptr;
                     }
                     return std::make_unique<IfElseNode>(std::move(condition), std::move(thenBranch), std::move(elseBranch));
                 }
             }
+        } else if (tokens[position].type == GOTO || tokens[position].type == GOSUB) {
+            NodeKind kind = tokens[position].type == GOTO ? GOTO_NODE : GOSUB_NODE;
+            position++;
+            if (isLineNumber(tokens[position])) {
+                return std::make_unique<GotoNode>(kind, static_cast<int>(tokens[position++].number.i));
+            }
+        } else if (tokens[position].type == RETURN) {
+            position++;
+            return std::make_unique<ControlNode>(RETURN_NODE);
+        } else if (tokens[position].type == END && !tokens[position].text.empty()) {
+            position++;
+            return std::make_unique<ControlNode>(END_NODE);
+        } else if (tokens[position].type == SAVE || tokens[position].type == LOAD) {
+            NodeKind kind = tokens[position].type == SAVE ? SAVE_NODE : LOAD_NODE;
+            position++;
+            return std::make_unique<ControlNode>(kind);
+        } else if (tokens[position].type == FOR) {
+            position++;
+            if (tokens[position].type != IDENTIFIER || tokens[position + 1].type != ASSIGN) return nullptr;
+            int slot = symbols.resolve(tokens[position].text);
+            position += 2;
+            auto start = parseExpression();
+            if (!start || tokens[position].type != TO) return nullptr;
+            position++;
+            auto limit = parseExpression();
+            if (!limit) return nullptr;
+            std::unique_ptr<ASTNode> step = nullptr;
+            if (tokens[position].type == STEP) {
+                position++;
+                step = parseExpression();
+                if (!step) return nullptr;
+            }
+            return std::make_unique<ForNode>(slot, std::move(start), std::move(limit), std::move(step));
+        } else if (tokens[position].type == NEXT) {
+            position++;
+            int slot = -1;
+            if (tokens[position].type == IDENTIFIER) {
+                slot = symbols.resolve(tokens[position++].text);
+            }
+            return std::make_unique<NextNode>(slot);
+        } else if (tokens[position].type == WHILE) {
+            position++;
+            auto condition = parseExpression();
+            if (!condition) return nullptr;
+            return std::make_unique<WhileNode>(std::move(condition));
+        } else if (tokens[position].type == WEND) {
+            position++;
+            return std::make_unique<WendNode>();
+        } else if (tokens[position].type == DIM) {
+            position++;
+            if (tokens[position].type != IDENTIFIER || tokens[position + 1].type != LEFT_PAREN) return nullptr;
+            int array = symbols.declareArray(tokens[position].text);
+            position += 2;
+            auto last = parseExpression();
+            if (!last || tokens[position].type != RIGHT_PAREN) return nullptr;
+            position++;
+            return std::make_unique<DimNode>(array, std::move(last));
         } else if (tokens[position].type == IDENTIFIER) {
-            std::string varName = tokens[position].value;
+            std::string_view varName = tokens[position].text;
             position++;
+            int array = symbols.findArray(varName);
+            if (array >= 0 && tokens[position].type == LEFT_PAREN) {
+                position++;
+                auto index = parseExpression();
+                if (!index || tokens[position].type != RIGHT_PAREN || tokens[position + 1].type != ASSIGN) return nullptr;
+                position += 2;
+                auto expr = parseExpression();
+                if (!expr) return nullptr;
+                return std::make_unique<ArrayStoreNode>(array, std::move(index), std::move(expr));
+            }
             if (tokens[position].type == ASSIGN) {
                 position++;
+                if (array >= 0) return parseArrayStatement(array);
                 auto expr = parseExpression();
-                return std::make_unique<AssignmentNode>(varName, std::move(expr));
+                if (!expr) return nullptr;
+                return std::make_unique<AssignmentNode>(symbols.resolve(varName), std::move(expr));
             }
         }
         return nullptr;
     }
 
-    std::unique_ptr<ASTNode> parseExpression() {
-        auto left = parseTerm();
-        while (position < tokens.size() && (tokens[position].type == PLUS || tokens[position].type == MINUS)) {
-            TokenType op = tokens[position].type;
+    // The right-hand side of an assignment to a whole array: an operand, or
+    // two joined by +, - or *, where a bare array name stands for every
+    // element. With no array on the right it is an ordinary expression and
+    // fills the array with its value.
+    std::unique_ptr<ASTNode> parseArrayStatement(int target) {
+        size_t start = position;
+        ArrayOperand left, right;
+        TokenType op = ASSIGN;
+        if (!parseArrayOperand(left)) return nullptr;
+        TokenType next = tokens[position].type;
+        if (next == PLUS || next == MINUS || next == MULTIPLY) {
+            op = next;
             position++;
-            auto right = parseTerm();
-            left = std::make_unique<BinaryOpNode>(std::move(left), std::move(right), op);
+            if (!parseArrayOperand(right)) return nullptr;
+        }
+        if (left.array < 0 && right.array < 0) {
+            position = start;
+            left.scalar = parseExpression();
+            if (!left.scalar) return nullptr;
+            right.scalar = nullptr;
+            op = ASSIGN;
         }
-        return left;
+        return std::make_unique<ArrayOpNode>(target, op, std::move(left), std::move(right));
     }
 
-    std::unique_ptr<ASTNode> parseTerm() {
-        auto left = parseFactor();
-        while (position < tokens.size() && (tokens[position].type == MULTIPLY || tokens[position].type == DIVIDE || tokens[position].type == MOD)) {
-            TokenType op = tokens[position].type;
-            position++;
-            auto right = parseFactor();
-            left = std::make_unique<BinaryOpNode>(std::move(left), std::move(right), op);
+    bool parseArrayOperand(ArrayOperand& operand) {
+        if (tokens[position].type == IDENTIFIER && tokens[position + 1].type != LEFT_PAREN) {
+            operand.array = symbols.findArray(tokens[position].text);
+            if (operand.array >= 0) {
+                position++;
+                return true;
+            }
+        }
+        operand.scalar = parseFactor();
+        return operand.scalar != nullptr;
+    }
+
+    std::unique_ptr<ASTNode> parseExpression() { return parseTerms(false); }
+
+    // A single operand: a number, variable, SUM, array element or
+    // parenthesized expression.
+    std::unique_ptr<ASTNode> parseFactor() { return parseTerms(true); }
+
+    // Precedence climbing over explicit stacks. An operator waits on
+    // `pending` until one binding no tighter arrives, and each open
+    // parenthesis or array index is a marker on it too, so however deeply a
+    // generated expression nests, the depth lives on the heap rather than
+    // in native calls. With single set, stops after the first operand.
+    std::unique_ptr<ASTNode> parseTerms(bool single) {
+        struct Pending {
+            TokenType op;  // LEFT_PAREN marks an open group or index
+            int array;     // The indexed array, for an index; otherwise -1
+        };
+        std::vector<std::unique_ptr<ASTNode>> operands;
+        std::vector<Pending> pending;
+        size_t open = 0;
+        // Folds the pending operators above the innermost marker that bind
+        // at least minimum.
+        auto reduce = [&](int minimum) {
+            while (!pending.empty() && pending.back().op != LEFT_PAREN && precedence(pending.back().op) >= minimum) {
+                auto right = std::move(operands.back());
+                operands.pop_back();
+                operands.back() = makeBinaryOp(std::move(operands.back()), std::move(right), pending.back().op);
+                pending.pop_back();
+            }
+        };
+        for (;;) {
+            for (;;) {
+                const Token& current = tokens[position];
+                if (current.type == LEFT_PAREN) {
+                    pending.push_back({LEFT_PAREN, -1});
+                } else if (current.type == IDENTIFIER && tokens[position + 1].type == LEFT_PAREN && !isArraySum(position)
+                           && symbols.findArray(current.text) >= 0) {
+                    pending.push_back({LEFT_PAREN, symbols.findArray(current.text)});
+                    position++;
+                } else {
+                    break;
+                }
+                position++;
+                open++;
+            }
+            auto operand = parsePrimary();
+            if (!operand) return nullptr;
+            operands.push_back(std::move(operand));
+            for (;;) {
+                TokenType type = tokens[position].type;
+                if (open > 0 && type == RIGHT_PAREN) {
+                    reduce(1);
+                    if (pending.back().array >= 0) {
+                        operands.back() = std::make_unique<ArrayElementNode>(pending.back().array, std::move(operands.back()));
+                    }
+                    pending.pop_back();
+                    position++;
+                    open--;
+                } else if (precedence(type) > 0 && (open > 0 || !single)) {
+                    reduce(precedence(type));
+                    pending.push_back({type, -1});
+                    position++;
+                    break;
+                } else if (open > 0) {
+                    return nullptr; // An unclosed parenthesis or index
+                } else {
+                    reduce(1);
+                    return std::move(operands.back());
+                }
+            }
         }
-        return left;
     }
 
-    std::unique_ptr<ASTNode> parseFactor() {
-        Token current = tokens[position];
+    // Whether the tokens at index spell SUM(array).
+    bool isArraySum(size_t index) const {
+        return tokens[index].text == "SUM" && tokens[index + 1].type == LEFT_PAREN && tokens[index + 2].type == IDENTIFIER
+            && tokens[index + 3].type == RIGHT_PAREN && symbols.findArray(tokens[index + 2].text) >= 0;
+    }
+
+    // A number, variable or SUM(array); everything that nests is handled by
+    // parseTerms().
+    std::unique_ptr<ASTNode> parsePrimary() {
+        const Token& current = tokens[position];
         if (current.type == NUMBER) {
             position++;
-            return std::make_unique<NumberNode>(std::stoi(current.value));
+            return std::make_unique<NumberNode>(current.number);
         } else if (current.type == IDENTIFIER) {
-            position++;
-            return std::make_unique<VariableNode>(current.value);
-        } else if (current.type == LEFT_PAREN) {
-            position++;
-            auto expr = parseExpression();
-            if (tokens[position].type == RIGHT_PAREN) {
-                position++;
-                return expr;
+            if (isArraySum(position)) {
+                int array = symbols.findArray(tokens[position + 2].text);
+                position += 4;
+                return std::make_unique<ArraySumNode>(array);
             }
+            position++;
+            return std::make_unique<VariableNode>(symbols.resolve(current.text));
         }
         return nullptr;
     }
 
     const std::vector<Token>& tokens;
+    SymbolTable& symbols;
     size_t position;
+    int label = -1;
 };
 
-int main() {
-    std::unordered_map<std::string, int> variables;
-    std::vector<std::string> lines;
-    std::string input;
-    std::cout << "BASIC Interpreter\nEnter END to finish input and RUN to execute.\n";
+// Optimization pass run between parsing and execution (enabled with -O).
+// Folds constant subexpressions and applies algebraic identities. Anything
+// that would trap at run time (division by zero, INT_MIN / -1) or overflow is
+// left in the tree so it still behaves exactly as it did unoptimized.
+class Optimizer {
+public:
+    // Returns the optimized statement, or nullptr if it can never do anything.
+    std::unique_ptr<ASTNode> optimizeStatement(std::unique_ptr<ASTNode> node) {
+        switch (node->kind) {
+            case ASSIGNMENT_NODE: {
+                auto& assignment = static_cast<AssignmentNode&>(*node);
+                assignment.expression = optimizeExpression(std::move(assignment.expression));
+                break;
+            }
+            case PRINT_NODE: {
+                auto& print = static_cast<PrintNode&>(*node);
+                print.expression = optimizeExpression(std::move(print.expression));
+                break;
+            }
+            case IF_ELSE_NODE: {
+                auto& ifElse = static_cast<IfElseNode&>(*node);
+                ifElse.condition = optimizeExpression(std::move(ifElse.condition));
+                ifElse.thenBranch = optimizeStatement(std::move(ifElse.thenBranch));
+                if (ifElse.elseBranch) {
+                    ifElse.elseBranch = optimizeStatement(std::move(ifElse.elseBranch));
+                }
+                if (ifElse.condition->kind == NUMBER_NODE) {
+                    nodesRemoved++;
+                    bool taken = static_cast<NumberNode&>(*ifElse.condition).value.isTrue();
+                    return taken ? std::move(ifElse.thenBranch) : std::move(ifElse.elseBranch);
+                }
+                if (!ifElse.thenBranch && !ifElse.elseBranch) {
+                    nodesRemoved++;
+                    return nullptr; // Conditions have no side effects
+                }
+                if (!ifElse.thenBranch) {
+                    // IF (c) <nothing> ELSE s  =>  IF (c == 0) s
+                    ifElse.condition = makeBinaryOp(std::move(ifElse.condition), std::make_unique<NumberNode>(0), EQUAL);
+                    ifElse.thenBranch = std::move(ifElse.elseBranch);
+                }
+                break;
+            }
+            case FOR_NODE: {
+                auto& loop = static_cast<ForNode&>(*node);
+                loop.start = optimizeExpression(std::move(loop.start));
+                loop.limit = optimizeExpression(std::move(loop.limit));
+                if (loop.step) {
+                    loop.step = optimizeExpression(std::move(loop.step));
+                }
+                break;
+            }
+            case WHILE_NODE: {
+                auto& loop = static_cast<WhileNode&>(*node);
+                loop.condition = optimizeExpression(std::move(loop.condition));
+                break;
+            }
+            case DIM_NODE: {
+                auto& dim = static_cast<DimNode&>(*node);
+                dim.last = optimizeExpression(std::move(dim.last));
+                break;
+            }
+            case ARRAY_STORE_NODE: {
+                auto& store = static_cast<ArrayStoreNode&>(*node);
+                store.index = optimizeExpression(std::move(store.index));
+                store.expression = optimizeExpression(std::move(store.expression));
+                break;
+            }
+            case ARRAY_OP_NODE: {
+                auto& arrayOp = static_cast<ArrayOpNode&>(*node);
+                if (arrayOp.left.scalar) arrayOp.left.scalar = optimizeExpression(std::move(arrayOp.left.scalar));
+                if (arrayOp.right.scalar) arrayOp.right.scalar = optimizeExpression(std::move(arrayOp.right.scalar));
+                break;
+            }
+            default:
+                break;
+        }
+        return node;
+    }
 
-    while (true) {
-        std::getline(std::cin, input);
-        if (input == "END") {
-            break;
+    std::unique_ptr<ASTNode> optimizeExpression(std::unique_ptr<ASTNode> node) {
+        if (node->kind == ARRAY_ELEMENT_NODE) {
+            auto& element = static_cast<ArrayElementNode&>(*node);
+            element.index = optimizeExpression(std::move(element.index));
+            return node;
         }
-        lines.push_back(input);
+        if (node->kind != BINARY_OP_NODE) {
+            return node;
+        }
+        auto& binary = static_cast<BinaryOpNode&>(*node);
+        binary.left = optimizeExpression(std::move(binary.left));
+        binary.right = optimizeExpression(std::move(binary.right));
+
+        const Value* left = constantValue(*binary.left);
+        const Value* right = constantValue(*binary.right);
+        if (left && right) {
+            Value folded;
+            if (foldBinary(binary.op, *left, *right, folded)) {
+                nodesRemoved += 2;
+                return std::make_unique<NumberNode>(folded);
+            }
+            return makeBinaryOp(std::move(binary.left), std::move(binary.right), binary.op);
+        }
+
+        // x - 0, x * 1, 1 * x, x / 1 => x. These hold for doubles too; x + 0
+        // and x * 0 do not (x = -0.0 and x = infinity), and x's type is only
+        // known at run time.
+        if (isInteger(right, 0) && binary.op == MINUS) return keep(std::move(binary.left));
+        if (isInteger(right, 1) && (binary.op == MULTIPLY || binary.op == DIVIDE)) return keep(std::move(binary.left));
+        if (isInteger(left, 1) && binary.op == MULTIPLY) return keep(std::move(binary.right));
+
+        // The operands may have changed shape.
+        return makeBinaryOp(std::move(binary.left), std::move(binary.right), binary.op);
+    }
+
+    size_t removedNodes() const { return nodesRemoved; }
+
+private:
+    static const Value* constantValue(const ASTNode& node) {
+        return node.kind == NUMBER_NODE ? &static_cast<const NumberNode&>(node).value : nullptr;
+    }
+
+    static bool isInteger(const Value* value, int64_t expected) {
+        return value && value->isInt() && value->i == expected;
     }
 
-    std::cout << "Program input finished. Type RUN to execute.\n";
+    // Folds with the operators' own code (overflow promotes the same way at
+    // compile time as at run time), except for a trapping integer division.
+    static bool foldBinary(TokenType op, Value left, Value right, Value& result) {
+        if (precedence(op) == 0) return false;
+        if ((op == DIVIDE || op == MOD) && isInteger(&right, 0) && left.isInt()) return false;
+        result = applyBinary(op, left, right);
+        return true;
+    }
 
-    std::getline(std::cin, input);
-    if (input == "RUN") {
-        for (const auto& line : lines) {
-            Tokenizer tokenizer(line);
-            std::vector<Token> tokens = tokenizer.tokenize();
+    std::unique_ptr<ASTNode> keep(std::unique_ptr<ASTNode> operand) {
+        nodesRemoved += 2;
+        return operand;
+    }
 
-            Parser parser(tokens);
-            std::unique_ptr<ASTNode> ast = parser.parse();
-            if (ast) {
-                ast->evaluate(variables);
-            } else {
-                std::cout << "Syntax error!" << std::endl;
+    size_t nodesRemoved = 0;
+};
+
+// Value numbering and dead-store elimination over a straight-line block: a
+// run of assignments and PRINTs that nothing jumps into past its first
+// statement. Expressions made of variables, numbers and operators get a
+// number each, equal for equal values (a + b and b + a; y + b after y = a and
+// a + b), so a value computed once is read back from the variable or
+// temporary holding it rather than computed again. A store is dead when the
+// same variable is stored again further down the block with no read in
+// between. Array elements are never numbered, and nothing is moved or removed
+// across a statement that can fail at run time (an array index or an integer
+// division), so a run that stops stops with the same state.
+class BlockOptimizer {
+public:
+    explicit BlockOptimizer(SymbolTable& symbols) : symbols(symbols) {}
+
+    static bool inBlock(const ASTNode& node) { return node.kind == ASSIGNMENT_NODE || node.kind == PRINT_NODE; }
+
+    // Rewrites a block. Statement i of the block becomes result[i]: nothing if
+    // it was a dead store, otherwise the statement, after the assignments of
+    // any temporaries it computes first.
+    std::vector<std::vector<std::unique_ptr<ASTNode>>> optimize(std::vector<std::unique_ptr<ASTNode>> block) {
+        size_t nodesBefore = 0;
+        for (const auto& statement : block) nodesBefore += countNodes(*statement);
+
+        // First pass: number every expression and count how often each value
+        // is computed. A repeat is replaced whole, so what is inside it only
+        // counts the first time.
+        numbers.clear();
+        expressions.clear();
+        constants.clear();
+        uses.clear();
+        values.assign(symbols.size(), -1);
+        std::vector<int> stored(block.size(), -1);
+        for (size_t i = 0; i < block.size(); i++) {
+            const ASTNode& expression = *statementExpression(*block[i]);
+            int value = number(expression);
+            countUses(expression);
+            if (block[i]->kind == ASSIGNMENT_NODE) {
+                stored[i] = value >= 0 ? value : nextNumber++;
+                values[static_cast<AssignmentNode&>(*block[i]).slot] = stored[i];
+            }
+        }
+
+        // Second pass, replaying the stores: a value already held somewhere is
+        // read from there, and one computed again later goes to a temporary.
+        std::vector<std::vector<std::unique_ptr<ASTNode>>> result(block.size());
+        values.assign(symbols.size(), -1);
+        holders.clear();
+        size_t firstTemporary = symbols.size();
+        for (size_t i = 0; i < block.size(); i++) {
+            ASTNode& statement = *block[i];
+            std::unique_ptr<ASTNode>& expression = statementExpression(statement);
+            bool temporaries = !canFail(*expression);
+            bool assignment = statement.kind == ASSIGNMENT_NODE;
+            expression = rewrite(std::move(expression), result[i], temporaries, assignment);
+            if (assignment) {
+                int slot = static_cast<AssignmentNode&>(statement).slot;
+                values[slot] = stored[i];
+                if (holder(stored[i]) < 0) holders[stored[i]] = slot;
             }
+            result[i].push_back(std::move(block[i]));
+        }
+
+        removeDeadStores(result, firstTemporary);
+        size_t nodesAfter = 0;
+        for (const auto& statements : result) {
+            for (const auto& statement : statements) nodesAfter += countNodes(*statement);
+        }
+        nodesRemoved += nodesBefore - std::min(nodesBefore, nodesAfter);
+        return result;
+    }
+
+    size_t reusedValues() const { return reused; }
+    size_t deadStores() const { return storesRemoved; }
+    size_t removedNodes() const { return nodesRemoved; }
+
+private:
+    static std::unique_ptr<ASTNode>& statementExpression(ASTNode& statement) {
+        return statement.kind == ASSIGNMENT_NODE ? static_cast<AssignmentNode&>(statement).expression
+                                                 : static_cast<PrintNode&>(statement).expression;
+    }
+
+    // The expression's value number, or -1 if it has none (it reads an array).
+    int number(const ASTNode& node) {
+        switch (node.kind) {
+            case NUMBER_NODE: {
+                const Value& value = static_cast<const NumberNode&>(node).value;
+                auto inserted = constants.emplace(std::make_pair(value.i, int(value.tag)), nextNumber);
+                if (inserted.second) nextNumber++;
+                return inserted.first->second;
+            }
+            case VARIABLE_NODE: {
+                int& value = values[static_cast<const VariableNode&>(node).slot];
+                if (value < 0) value = nextNumber++;
+                return value;
+            }
+            case BINARY_OP_NODE: {
+                const auto& binary = static_cast<const BinaryOpNode&>(node);
+                int left = number(*binary.left);
+                int right = number(*binary.right);
+                if (left < 0 || right < 0) return -1;
+                if ((binary.op == PLUS || binary.op == MULTIPLY || binary.op == EQUAL || binary.op == NOT_EQUAL
+                     || binary.op == AND || binary.op == OR) && right < left) {
+                    std::swap(left, right);
+                }
+                auto inserted = expressions.emplace(std::make_tuple(int(binary.op), left, right), nextNumber);
+                if (inserted.second) nextNumber++;
+                numbers[&node] = inserted.first->second;
+                return inserted.first->second;
+            }
+            default:
+                return -1;
+        }
+    }
+
+    void countUses(const ASTNode& node) {
+        if (node.kind != BINARY_OP_NODE) return;
+        auto it = numbers.find(&node);
+        if (it != numbers.end() && uses[it->second]++ > 0) return;
+        const auto& binary = static_cast<const BinaryOpNode&>(node);
+        countUses(*binary.left);
+        countUses(*binary.right);
+    }
+
+    // The slot still holding the value, or -1.
+    int holder(int value) const {
+        auto it = holders.find(value);
+        return it != holders.end() && values[it->second] == value ? it->second : -1;
+    }
+
+    // A whole assignment's value is held by its variable afterwards, so only
+    // a part of one (or of a PRINT) goes to a temporary.
+    std::unique_ptr<ASTNode> rewrite(std::unique_ptr<ASTNode> node, std::vector<std::unique_ptr<ASTNode>>& before,
+                                     bool temporaries, bool whole) {
+        if (node->kind != BINARY_OP_NODE) return node;
+        auto it = numbers.find(node.get());
+        int value = it != numbers.end() ? it->second : -1;
+        if (value >= 0) {
+            int slot = holder(value);
+            if (slot >= 0) {
+                reused++;
+                return std::make_unique<VariableNode>(slot);
+            }
+        }
+        auto& binary = static_cast<BinaryOpNode&>(*node);
+        std::unique_ptr<ASTNode> left = rewrite(std::move(binary.left), before, temporaries, false);
+        std::unique_ptr<ASTNode> right = rewrite(std::move(binary.right), before, temporaries, false);
+        std::unique_ptr<ASTNode> rebuilt = makeBinaryOp(std::move(left), std::move(right), binary.op);
+        if (value < 0 || whole || !temporaries || uses[value] < 2) return rebuilt;
+        int temporary = symbols.temporary();
+        values.resize(symbols.size(), -1);
+        values[temporary] = value;
+        holders[value] = temporary;
+        before.push_back(std::make_unique<AssignmentNode>(temporary, std::move(rebuilt)));
+        return std::make_unique<VariableNode>(temporary);
+    }
+
+    // Walks the block backwards. dead[slot] means the slot is stored again
+    // below before anything reads it; the block's own temporaries are never
+    // read after it.
+    void removeDeadStores(std::vector<std::vector<std::unique_ptr<ASTNode>>>& block, size_t firstTemporary) {
+        std::vector<char> dead(symbols.size(), 0);
+        std::fill(dead.begin() + firstTemporary, dead.end(), 1);
+        for (size_t i = block.size(); i-- > 0;) {
+            auto& statements = block[i];
+            for (size_t k = statements.size(); k-- > 0;) {
+                ASTNode& statement = *statements[k];
+                const ASTNode& expression = *statementExpression(statement);
+                bool fails = canFail(expression);
+                if (statement.kind == ASSIGNMENT_NODE) {
+                    int slot = static_cast<AssignmentNode&>(statement).slot;
+                    if (dead[slot] && !fails) {
+                        statements.erase(statements.begin() + k);
+                        storesRemoved++;
+                        continue;
+                    }
+                    dead[slot] = 1;
+                }
+                if (fails) std::fill(dead.begin(), dead.begin() + firstTemporary, 0);
+                markRead(expression, dead);
+            }
+        }
+    }
+
+    static void markRead(const ASTNode& node, std::vector<char>& dead) {
+        if (node.kind == VARIABLE_NODE) {
+            dead[static_cast<const VariableNode&>(node).slot] = 0;
+        } else if (node.kind == BINARY_OP_NODE) {
+            const auto& binary = static_cast<const BinaryOpNode&>(node);
+            markRead(*binary.left, dead);
+            markRead(*binary.right, dead);
+        } else if (node.kind == ARRAY_ELEMENT_NODE) {
+            markRead(*static_cast<const ArrayElementNode&>(node).index, dead);
+        } else if (node.kind == FLAT_EXPRESSION_NODE) {
+            for (const FlatStep& step : static_cast<const FlatExpressionNode&>(node).steps) {
+                if (step.code == FlatStep::VARIABLE || step.code == FlatStep::APPLY_VARIABLE) dead[step.slot] = 0;
+            }
+        }
+    }
+
+    // Whether evaluating the expression can stop the run: an array index out
+    // of bounds, or an integer division by anything but a nonzero constant.
+    static bool canFail(const ASTNode& node) {
+        switch (node.kind) {
+            case NUMBER_NODE:
+            case VARIABLE_NODE:
+                return false;
+            case BINARY_OP_NODE: {
+                const auto& binary = static_cast<const BinaryOpNode&>(node);
+                if ((binary.op == DIVIDE || binary.op == MOD)
+                    && !(binary.right->kind == NUMBER_NODE && static_cast<const NumberNode&>(*binary.right).value.isTrue())) {
+                    return true;
+                }
+                return canFail(*binary.left) || canFail(*binary.right);
+            }
+            default:
+                return true;
+        }
+    }
+
+    SymbolTable& symbols;
+    int nextNumber = 0;
+    std::unordered_map<const ASTNode*, int> numbers;        // Operator node -> value number
+    std::map<std::tuple<int, int, int>, int> expressions;   // (operator, left, right) -> value number
+    std::map<std::pair<int64_t, int>, int> constants;       // (payload, tag) -> value number
+    std::unordered_map<int, size_t> uses;                   // Value number -> times computed
+    std::unordered_map<int, int> holders;                   // Value number -> slot last given it
+    std::vector<int> values;                                // Slot -> value number it holds
+    size_t reused = 0;
+    size_t storesRemoved = 0;
+    size_t nodesRemoved = 0;
+};
+
+// Buffered output for PRINT. Integers are formatted with to_chars straight
+// into a large buffer, which is written to a file descriptor or appended to a
+// caller-owned string. When it is flushed, beyond a full buffer, is decided by
+// the flush policy.
+#ifdef _WIN32
+#include <io.h>
+#define BASIC_WRITE _write
+#define BASIC_ISATTY _isatty
+#else
+#include <unistd.h>
+#define BASIC_WRITE ::write
+#define BASIC_ISATTY ::isatty
+#endif
+
+enum FlushPolicy : unsigned {
+    FLUSH_ON_NEWLINE = 1,  // After every line
+    FLUSH_ON_INPUT = 2,    // Before INPUT reads, so prompts are visible
+    FLUSH_AT_EXIT = 4      // When the sink is destroyed
+};
+
+class OutputSink {
+public:
+    static const size_t BUFFER_SIZE = 64 * 1024;
+
+    // Interactive terminals see every line as it is printed; pipes and files
+    // only get whole buffers.
+    static unsigned defaultPolicy(int fd) {
+        return FLUSH_ON_INPUT | FLUSH_AT_EXIT | (BASIC_ISATTY(fd) ? unsigned(FLUSH_ON_NEWLINE) : 0u);
+    }
+
+    explicit OutputSink(int fd) : OutputSink(fd, defaultPolicy(fd)) {}
+    OutputSink(int fd, unsigned policy) : buffer(new char[BUFFER_SIZE]), fd(fd), policy(policy) {}
+
+    // Appends to the given string, which must outlive the sink.
+    explicit OutputSink(std::string& target, unsigned policy = FLUSH_ON_INPUT | FLUSH_AT_EXIT)
+        : buffer(new char[BUFFER_SIZE]), target(&target), policy(policy) {}
+
+    // A sink that drops everything, for benchmarks.
+    static OutputSink discard() { return OutputSink(-1, 0); }
+
+    OutputSink(OutputSink&& other) noexcept
+        : buffer(std::move(other.buffer)), used(other.used), fd(other.fd), target(other.target), policy(other.policy) {
+        other.policy = 0;
+    }
+    OutputSink(const OutputSink&) = delete;
+    OutputSink& operator=(const OutputSink&) = delete;
+
+    ~OutputSink() {
+        if (policy & FLUSH_AT_EXIT) flush();
+    }
+
+    void write(std::string_view text) {
+        if (text.size() > BUFFER_SIZE - used) {
+            flush();
+            if (text.size() > BUFFER_SIZE) {
+                emit(text.data(), text.size());
+                return;
+            }
+        }
+        text.copy(buffer.get() + used, text.size());
+        used += text.size();
+    }
+
+    void writeValue(Value value) {
+        if (BUFFER_SIZE - used < MAX_VALUE_TEXT) flush();
+        used = formatValue(buffer.get() + used, value) - buffer.get();
+    }
+
+    void newline() {
+        if (used == BUFFER_SIZE) flush();
+        buffer[used++] = '\n';
+        if (policy & FLUSH_ON_NEWLINE) flush();
+    }
+
+    // A PRINT statement's whole output line.
+    void printLine(Value value) {
+        writeValue(value);
+        newline();
+    }
+
+    void beforeInput() {
+        if (policy & FLUSH_ON_INPUT) flush();
+    }
+
+    void flush() {
+        if (used > 0) {
+            emit(buffer.get(), used);
+            used = 0;
+        }
+    }
+
+private:
+    void emit(const char* data, size_t size) {
+        if (target) {
+            target->append(data, size);
+            return;
+        }
+        while (fd >= 0 && size > 0) {
+            auto written = BASIC_WRITE(fd, data, static_cast<unsigned>(size));
+            if (written < 0) {
+                if (errno == EINTR) continue;
+                return; // Nowhere left to report a broken stdout
+            }
+            data += written;
+            size -= written;
+        }
+    }
+
+    std::unique_ptr<char[]> buffer;
+    size_t used = 0;
+    int fd = -1;
+    std::string* target = nullptr;
+    unsigned policy;
+};
+
+// A whole file's contents, memory-mapped read-only where the platform allows
+// and read into memory otherwise.
+#if defined(__unix__) || defined(__APPLE__)
+#define BASIC_MMAP 1
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#else
+#define BASIC_MMAP 0
+#endif
+
+class MappedFile {
+public:
+    MappedFile() = default;
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+    ~MappedFile() { close(); }
+
+    bool open(const std::string& path) {
+        close();
+#if BASIC_MMAP
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) return false;
+        struct stat info;
+        if (fstat(fd, &info) != 0) {
+            ::close(fd);
+            return false;
+        }
+        if (info.st_size > 0) {
+            void* mapped = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (mapped == MAP_FAILED) {
+                ::close(fd);
+                return false;
+            }
+            madvise(mapped, info.st_size, MADV_SEQUENTIAL);
+            mapping = mapped;
+            contents = std::string_view(static_cast<const char*>(mapped), info.st_size);
+        }
+        ::close(fd);
+        return true;
+#else
+        std::ifstream file(path, std::ios::binary);
+        if (!file) return false;
+        owned.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+        contents = owned;
+        return true;
+#endif
+    }
+
+    void close() {
+#if BASIC_MMAP
+        if (mapping) munmap(mapping, contents.size());
+        mapping = nullptr;
+#endif
+        contents = std::string_view();
+    }
+
+    std::string_view data() const { return contents; }
+
+private:
+    std::string_view contents;
+#if BASIC_MMAP
+    void* mapping = nullptr;
+#else
+    std::string owned;
+#endif
+};
+
+// The hashes and checksums of program images and snapshots: FNV-1a over
+// 8-byte words rather than bytes, so checking a large file costs little next
+// to mapping it.
+uint64_t hashBytes(std::string_view bytes) {
+    const uint64_t prime = 1099511628211ull;
+    uint64_t hash = 14695981039346656037ull ^ bytes.size();
+    size_t i = 0;
+    for (; i + 8 <= bytes.size(); i += 8) {
+        uint64_t word;
+        std::memcpy(&word, bytes.data() + i, 8);
+        hash = (hash ^ word) * prime;
+        hash ^= hash >> 32;
+    }
+    for (; i < bytes.size(); i++) {
+        hash = (hash ^ static_cast<unsigned char>(bytes[i])) * prime;
+    }
+    return hash;
+}
+
+// Ties a snapshot to the program that saved it: the variables and arrays
+// (names, in slot order) and the number of statements, which together fix
+// what every slot and every resume point means.
+uint64_t programFingerprint(const SymbolTable& symbols, size_t statements) {
+    std::string shape = std::to_string(statements);
+    for (size_t slot = 0; slot < symbols.size(); slot++) {
+        shape += '\0';
+        shape += symbols.name(static_cast<int>(slot));
+    }
+    shape += '\1';
+    for (size_t array = 0; array < symbols.arrayCount(); array++) {
+        shape += '\0';
+        shape += symbols.arrayName(static_cast<int>(array));
+    }
+    return hashBytes(shape);
+}
+
+// Where SAVE writes a run's state and LOAD adopts it.
+struct SnapshotFile {
+    std::string path;          // Empty: SAVE and LOAD do nothing
+    uint64_t fingerprint = 0;  // Of the running program
+    size_t statements = 0;     // Resume points run from 0 to this
+};
+
+const char* const CANNOT_SAVE = "Cannot write snapshot!";
+const char* const BAD_SNAPSHOT = "Snapshot does not match this program!";
+
+// A snapshot is a header, the frame's values, the GOSUB return stack and
+// then each array as its length and elements. Control points are statement
+// indices, so a snapshot saved by one engine resumes on any other.
+struct SnapshotHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t arrayCount;
+    uint64_t fingerprint;
+    uint64_t checksum;      // Of everything after the header
+    uint64_t size;          // Of the whole file
+    uint64_t resume;        // The statement to continue at
+    uint64_t valueCount;
+    uint64_t returnCount;
+};
+
+const char SNAPSHOT_MAGIC[8] = {'B', 'A', 'S', 'I', 'C', 'S', 'N', 'P'};
+const uint32_t SNAPSHOT_VERSION = 1;
+
+// SAVE: writes the frame, the statement to resume at and the return stack.
+// The file is written beside the old one and renamed over it, so a crash
+// mid-save leaves the previous snapshot intact.
+BASIC_COLD const char* saveSnapshot(const SnapshotFile& file, const Frame& frame, size_t resume,
+                         const std::vector<size_t>& returnStack) {
+    if (file.path.empty()) return nullptr;
+    std::string body;
+    size_t bytes = frame.size() * sizeof(Value) + returnStack.size() * sizeof(uint64_t);
+    for (const IntArray& array : frame.arrays) bytes += sizeof(uint64_t) + (array.size() * sizeof(int) + 7) / 8 * 8;
+    body.reserve(bytes);
+    // Field by field into zeroed space, so the padding after each tag is zero
+    // and the same state always gives the same file.
+    body.resize(frame.size() * sizeof(Value), '\0');
+    for (size_t slot = 0; slot < frame.size(); slot++) {
+        const Value& value = frame.data()[slot];
+        std::memcpy(&body[slot * sizeof(Value) + offsetof(Value, i)], &value.i, sizeof(value.i));
+        std::memcpy(&body[slot * sizeof(Value) + offsetof(Value, tag)], &value.tag, sizeof(value.tag));
+    }
+    for (size_t target : returnStack) {
+        uint64_t word = target;
+        body.append(reinterpret_cast<const char*>(&word), sizeof(word));
+    }
+    for (const IntArray& array : frame.arrays) {
+        uint64_t length = array.size();
+        body.append(reinterpret_cast<const char*>(&length), sizeof(length));
+        body.append(reinterpret_cast<const char*>(array.data()), array.size() * sizeof(int));
+        body.resize((body.size() + 7) / 8 * 8, '\0');
+    }
+
+    SnapshotHeader header;
+    std::memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+    header.version = SNAPSHOT_VERSION;
+    header.arrayCount = static_cast<uint32_t>(frame.arrays.size());
+    header.fingerprint = file.fingerprint;
+    header.checksum = hashBytes(body);
+    header.size = sizeof(header) + body.size();
+    header.resume = resume;
+    header.valueCount = frame.size();
+    header.returnCount = returnStack.size();
+
+    std::string temporary = file.path + ".tmp";
+    {
+        std::ofstream out(temporary, std::ios::binary | std::ios::trunc);
+        out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        out.write(body.data(), static_cast<std::streamsize>(body.size()));
+        if (!out) {
+            std::remove(temporary.c_str());
+            return CANNOT_SAVE;
+        }
+    }
+    return std::rename(temporary.c_str(), file.path.c_str()) == 0 ? nullptr : CANNOT_SAVE;
+}
+
+// LOAD: maps the snapshot and adopts it, copying each section into the frame
+// in one piece, so resuming costs time in proportion to the state and not to
+// the run that built it. Without a snapshot file nothing changes: resume and
+// returnStack keep what the caller put there.
+BASIC_COLD const char* loadSnapshot(const SnapshotFile& file, Frame& frame, size_t& resume, std::vector<size_t>& returnStack) {
+    if (file.path.empty()) return nullptr;
+    MappedFile mapped;
+    if (!mapped.open(file.path)) return nullptr;
+    std::string_view data = mapped.data();
+    if (data.size() < sizeof(SnapshotHeader)) return BAD_SNAPSHOT;
+    SnapshotHeader header;
+    std::memcpy(&header, data.data(), sizeof(header));
+    if (std::memcmp(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic)) != 0 || header.version != SNAPSHOT_VERSION
+        || header.fingerprint != file.fingerprint || header.size != data.size() || header.valueCount != frame.size()
+        || header.arrayCount != frame.arrays.size() || hashBytes(data.substr(sizeof(header))) != header.checksum) {
+        return BAD_SNAPSHOT;
+    }
+
+    // The checksum does not cover the header, so every length is checked
+    // against what is left of the file before anything is read or adopted.
+    const char* next = data.data() + sizeof(header);
+    size_t left = data.size() - sizeof(header);
+    auto take = [&](uint64_t count, size_t size, size_t padded) -> const char* {
+        if (count > left / size || (count * size + padded - 1) / padded * padded > left) return nullptr;
+        const char* section = next;
+        size_t bytes = (count * size + padded - 1) / padded * padded;
+        next += bytes;
+        left -= bytes;
+        return section;
+    };
+    const Value* values = reinterpret_cast<const Value*>(take(header.valueCount, sizeof(Value), 8));
+    const uint64_t* targets = reinterpret_cast<const uint64_t*>(take(header.returnCount, sizeof(uint64_t), 8));
+    if (!values || !targets || header.resume > file.statements
+        || std::any_of(targets, targets + header.returnCount, [&](uint64_t target) { return target > file.statements; })) {
+        return BAD_SNAPSHOT;
+    }
+    std::vector<std::pair<const int*, uint64_t>> arrays;
+    for (size_t array = 0; array < frame.arrays.size(); array++) {
+        const char* length = take(1, sizeof(uint64_t), 8);
+        if (!length) return BAD_SNAPSHOT;
+        uint64_t count;
+        std::memcpy(&count, length, sizeof(count));
+        const int* elements = reinterpret_cast<const int*>(take(count, sizeof(int), 8));
+        if (!elements) return BAD_SNAPSHOT;
+        arrays.emplace_back(elements, count);
+    }
+    if (left != 0) return BAD_SNAPSHOT;
+
+    frame.values.assign(values, values + header.valueCount);
+    returnStack.assign(targets, targets + header.returnCount);
+    for (size_t array = 0; array < arrays.size(); array++) {
+        frame.arrays[array].assign(arrays[array].first, arrays[array].first + arrays[array].second);
+    }
+    resume = header.resume;
+    return nullptr;
+}
+
+// Where INPUT values come from. A data file is mapped (or read) whole and
+// parsed in place with from_chars; a stream is parsed straight from its
+// buffer one number at a time, so it never reads past the value it needs.
+// Like std::cin >> value, a malformed or missing value reads as 0 and every
+// later read does too.
+
+class InputSource {
+public:
+    // Parses from a stream; prompts should be on for interactive terminals.
+    InputSource(std::istream& stream, bool prompts) : stream(stream.rdbuf()), prompting(prompts) {}
+
+    // Parses a caller-owned buffer, which must outlive the source. No prompts.
+    explicit InputSource(std::string_view data) : data(data) {}
+
+    InputSource(const InputSource&) = delete;
+    InputSource& operator=(const InputSource&) = delete;
+
+    // Opens a data file. Returns null if it cannot be read.
+    static std::unique_ptr<InputSource> openFile(const std::string& path) {
+        auto source = std::make_unique<InputSource>(std::string_view());
+        if (!source->file.open(path)) {
+            return nullptr;
+        }
+        source->data = source->file.data();
+        return source;
+    }
+
+    bool prompts() const { return prompting; }
+
+    // One INPUT statement: prompt (if enabled) and read the next value.
+    Value read(std::string_view variable, OutputSink& output) {
+        if (prompting) {
+            output.write("Enter value for ");
+            output.write(variable);
+            output.write(": ");
+        }
+        output.beforeInput();
+        return readValue();
+    }
+
+    // An integer, or a double if the number has a fraction or is too big
+    // for 64 bits.
+    Value readValue() {
+        if (failed) return 0;
+        return stream ? readFromStream() : readFromBuffer();
+    }
+
+private:
+    Value readFromBuffer() {
+        const char* end = data.data() + data.size();
+        const char* p = data.data() + position;
+        while (p < end && isspace(static_cast<unsigned char>(*p))) p++;
+        if (p < end && *p == '+') p++;
+        return finish(p, end, p - data.data());
+    }
+
+    Value readFromStream() {
+        int c = stream->sgetc();
+        while (c != EOF && isspace(c)) c = stream->snextc();
+        // Sign, digits and a fraction, cut off at 128 characters.
+        char text[128];
+        size_t length = 0;
+        if (c == '+' || c == '-') {
+            if (c == '-') text[length++] = '-';
+            c = stream->snextc();
+        }
+        bool point = false;
+        while (c != EOF && (isdigit(c) || (c == '.' && !point))) {
+            point |= c == '.';
+            if (length < sizeof(text)) text[length] = static_cast<char>(c);
+            length++;
+            c = stream->snextc();
+        }
+        return finish(text, text + std::min(length, sizeof(text)), 0);
+    }
+
+    // Parses [begin, end); `base` is the buffer offset of begin.
+    Value finish(const char* begin, const char* end, size_t base) {
+        Value value;
+        auto result = std::from_chars(begin, end, value.i);
+        if (result.ec == std::errc::invalid_argument) {
+            failed = true;
+            return 0;
+        }
+        bool fraction = result.ptr + 1 < end && *result.ptr == '.' && isdigit(static_cast<unsigned char>(result.ptr[1]));
+        if (fraction || result.ec == std::errc::result_out_of_range) {
+            double real = 0;
+            result = std::from_chars(begin, end, real, std::chars_format::fixed);
+            if (result.ec != std::errc()) {
+                failed = true;
+                return 0;
+            }
+            value = Value::real(real);
+        }
+        position = base + (result.ptr - begin);
+        return value;
+    }
+
+    std::streambuf* stream = nullptr;
+    std::string_view data;
+    size_t position = 0;
+    bool prompting = false;
+    bool failed = false;
+    MappedFile file;
+};
+
+// Bytecode engine: an alternative to walking the AST. The compiler flattens the
+// parsed statements into a linear instruction array for a stack machine.
+enum OpCode : uint8_t {
+    OP_PUSH,          // push operand
+    OP_PUSH_CONST,    // push constants[operand], for values that are not 32-bit integers
+    OP_LOAD,          // push frame[operand]
+    OP_STORE,         // frame[operand] = pop
+    OP_ADD,
+    OP_SUB,
+    OP_MUL,
+    OP_DIV,
+    OP_MOD,
+    OP_EQ,
+    OP_NE,
+    OP_LT,
+    OP_GT,
+    OP_LE,
+    OP_GE,
+    OP_AND,
+    OP_OR,
+    OP_PRINT,         // print pop to the run's OutputSink
+    OP_INPUT,         // frame[operand] = value read from the run's InputSource
+    OP_JUMP_IF_ZERO,  // if pop == 0, jump to operand
+    OP_JUMP,          // jump to operand
+    OP_CALL,          // push return address, jump to operand
+    OP_RETURN,        // jump to popped return address
+    OP_FOR_ENTER,     // start loops[operand]; skip it if it runs zero times
+    OP_FOR_NEXT,      // step loops[operand]; jump back if it continues
+    OP_DIM,           // DIM array operand with pop as its last index
+    OP_ALOAD,         // index = pop; push array operand's element
+    OP_ASTORE,        // value = pop, index = pop; store into array operand
+    OP_ARRAY_OP,      // whole-array statement arrayOps[operand], popping its scalars
+    OP_ASUM,          // push the sum of array operand
+    OP_INC,           // frame[operand] += 1
+    OP_ADD_TO,        // frame[operand] += pop
+    OP_PRINT_VAR,     // print frame[operand]
+    OP_TEST_EQUAL,    // go on if compares[operand] holds (x == k), else jump to its target
+    OP_TEST_NOT_EQUAL, // go on if it does not (x - k is true), else jump
+    OP_SAVE_STATE,    // SAVE, resuming at statement operand
+    OP_LOAD_STATE,    // LOAD; without a snapshot, go on at statement operand
+    OP_HALT
+};
+
+struct Instruction {
+    OpCode op;
+    int operand;
+};
+
+// Slots and jump target of a FOR_ENTER or FOR_NEXT instruction.
+struct LoopInfo {
+    int counter;
+    int limit;
+    int step;
+    int target;
+};
+
+// The slot, constant and jump target of a TEST_EQUAL or TEST_NOT_EQUAL
+// instruction: a fused IF (x == k) or IF (x - k).
+struct CompareInfo {
+    int slot;
+    int target;
+    int64_t constant;
+};
+
+// Operands of an ARRAY_OP instruction, as in applyArrayOp(). A scalar
+// operand (array -1) is on the stack, the right one on top.
+struct ArrayOpInfo {
+    int target;
+    TokenType op;
+    int left;
+    int right;
+};
+
+// The arrays the VM runs, wherever they live: in a Bytecode, or in a mapped
+// program image.
+struct BytecodeView {
+    const Instruction* code;
+    const LoopInfo* loops;
+    const ArrayOpInfo* arrayOps;
+    const CompareInfo* compares;
+    const Value* constants;
+    size_t maxStack;
+    const int* statementStarts;  // Statement index -> code offset, one past the last included
+    size_t statementCount;
+};
+
+struct Bytecode {
+    std::vector<Instruction> code;
+    std::vector<LoopInfo> loops;
+    std::vector<ArrayOpInfo> arrayOps;
+    std::vector<CompareInfo> compares;
+    std::vector<Value> constants;
+    std::vector<int> statementStarts;
+    size_t maxStack = 0;
+
+    BytecodeView view() const {
+        return {code.data(), loops.data(), arrayOps.data(), compares.data(), constants.data(), maxStack, statementStarts.data(),
+                statementStarts.size() - 1};
+    }
+};
+
+class BytecodeCompiler {
+public:
+    // Without fusing, every statement compiles to the plain instructions.
+    explicit BytecodeCompiler(bool fuse = true) : fuse(fuse) {}
+
+    Bytecode compile(const std::vector<std::unique_ptr<ASTNode>>& statements) {
+        output = Bytecode();
+        depth = 0;
+        jumpFixups.clear();
+        loopFixups.clear();
+        std::vector<int> statementOffsets;
+        statementOffsets.reserve(statements.size() + 1);
+        for (statement = 0; statement < statements.size(); statement++) {
+            statementOffsets.push_back(static_cast<int>(output.code.size()));
+            compileStatement(*statements[statement]);
+        }
+        statementOffsets.push_back(static_cast<int>(output.code.size()));
+        emit(OP_HALT);
+
+        // Statement-index jump targets become code offsets now that all are known.
+        for (const auto& fixup : jumpFixups) {
+            output.code[fixup.first].operand = statementOffsets[fixup.second];
+        }
+        for (const auto& fixup : loopFixups) {
+            output.loops[fixup.first].target = statementOffsets[fixup.second];
+        }
+        output.statementStarts = std::move(statementOffsets);
+        return std::move(output);
+    }
+
+private:
+    void compileStatement(const ASTNode& node) {
+        switch (node.kind) {
+            case ASSIGNMENT_NODE: {
+                const auto& assignment = static_cast<const AssignmentNode&>(node);
+                const ASTNode* addend = fuse ? accumulatedAddend(assignment) : nullptr;
+                if (addend && addend->kind == NUMBER_NODE && static_cast<const NumberNode&>(*addend).value.identical(1)) {
+                    emit(OP_INC, assignment.slot);
+                } else if (addend) {
+                    compileExpression(*addend);
+                    emit(OP_ADD_TO, assignment.slot);
+                    pop(1);
+                } else {
+                    compileExpression(*assignment.expression);
+                    emit(OP_STORE, assignment.slot);
+                    pop(1);
+                }
+                break;
+            }
+            case PRINT_NODE: {
+                const ASTNode& expression = *static_cast<const PrintNode&>(node).expression;
+                if (fuse && expression.kind == VARIABLE_NODE) {
+                    emit(OP_PRINT_VAR, static_cast<const VariableNode&>(expression).slot);
+                    break;
+                }
+                compileExpression(expression);
+                emit(OP_PRINT);
+                pop(1);
+                break;
+            }
+            case INPUT_NODE:
+                emit(OP_INPUT, static_cast<const InputNode&>(node).slot);
+                break;
+            case IF_ELSE_NODE: {
+                const auto& ifElse = static_cast<const IfElseNode&>(node);
+                ConstantTest test = fuse ? constantTest(*ifElse.condition) : ConstantTest();
+                size_t jumpToElse;
+                if (test.slot >= 0) {
+                    output.compares.push_back({test.slot, 0, test.constant});
+                    jumpToElse = emit(test.equal ? OP_TEST_EQUAL : OP_TEST_NOT_EQUAL,
+                                      static_cast<int>(output.compares.size() - 1));
+                } else {
+                    compileExpression(*ifElse.condition);
+                    jumpToElse = emit(OP_JUMP_IF_ZERO);
+                    pop(1);
+                }
+                compileStatement(*ifElse.thenBranch);
+                if (ifElse.elseBranch) {
+                    size_t jumpToEnd = emit(OP_JUMP);
+                    patch(jumpToElse);
+                    compileStatement(*ifElse.elseBranch);
+                    patch(jumpToEnd);
+                } else {
+                    patch(jumpToElse);
+                }
+                break;
+            }
+            case GOTO_NODE:
+            case GOSUB_NODE: {
+                const auto& jump = static_cast<const GotoNode&>(node);
+                jumpFixups.emplace_back(emit(node.kind == GOTO_NODE ? OP_JUMP : OP_CALL), jump.target);
+                break;
+            }
+            case RETURN_NODE:
+                emit(OP_RETURN);
+                break;
+            case END_NODE:
+                emit(OP_HALT);
+                break;
+            case SAVE_NODE:
+                emit(OP_SAVE_STATE, static_cast<int>(statement + 1));
+                break;
+            case LOAD_NODE:
+                emit(OP_LOAD_STATE, static_cast<int>(statement + 1));
+                break;
+            case FOR_NODE: {
+                const auto& loop = static_cast<const ForNode&>(node);
+                compileExpression(*loop.start);
+                emit(OP_STORE, loop.slot);
+                compileExpression(*loop.limit);
+                emit(OP_STORE, loop.limitSlot);
+                if (loop.step) {
+                    compileExpression(*loop.step);
+                } else {
+                    emit(OP_PUSH, 1);
+                    push(1);
+                }
+                emit(OP_STORE, loop.stepSlot);
+                pop(3);
+                emit(OP_FOR_ENTER, addLoop(loop.slot, loop.limitSlot, loop.stepSlot, loop.exitTarget));
+                break;
+            }
+            case NEXT_NODE: {
+                const auto& next = static_cast<const NextNode&>(node);
+                emit(OP_FOR_NEXT, addLoop(next.slot, next.limitSlot, next.stepSlot, next.bodyTarget));
+                break;
+            }
+            case WHILE_NODE: {
+                const auto& loop = static_cast<const WhileNode&>(node);
+                compileExpression(*loop.condition);
+                jumpFixups.emplace_back(emit(OP_JUMP_IF_ZERO), loop.exitTarget);
+                pop(1);
+                break;
+            }
+            case WEND_NODE:
+                jumpFixups.emplace_back(emit(OP_JUMP), static_cast<const WendNode&>(node).loopTarget);
+                break;
+            case DIM_NODE: {
+                const auto& dim = static_cast<const DimNode&>(node);
+                compileExpression(*dim.last);
+                emit(OP_DIM, dim.array);
+                pop(1);
+                break;
+            }
+            case ARRAY_STORE_NODE: {
+                const auto& store = static_cast<const ArrayStoreNode&>(node);
+                compileExpression(*store.index);
+                compileExpression(*store.expression);
+                emit(OP_ASTORE, store.array);
+                pop(2);
+                break;
+            }
+            case ARRAY_OP_NODE: {
+                const auto& arrayOp = static_cast<const ArrayOpNode&>(node);
+                size_t scalars = 0;
+                for (const ArrayOperand* operand : {&arrayOp.left, &arrayOp.right}) {
+                    if (operand->scalar) {
+                        compileExpression(*operand->scalar);
+                        scalars++;
+                    }
+                }
+                output.arrayOps.push_back({arrayOp.target, arrayOp.op, arrayOp.left.array, arrayOp.right.array});
+                emit(OP_ARRAY_OP, static_cast<int>(output.arrayOps.size() - 1));
+                pop(scalars);
+                break;
+            }
+            default:
+                // A bare expression is evaluated for its side effects only; none have any.
+                break;
+        }
+    }
+
+    void compileExpression(const ASTNode& node) {
+        switch (node.kind) {
+            case NUMBER_NODE:
+                emitConstant(static_cast<const NumberNode&>(node).value);
+                break;
+            case VARIABLE_NODE:
+                emit(OP_LOAD, static_cast<const VariableNode&>(node).slot);
+                push(1);
+                break;
+            case BINARY_OP_NODE: {
+                const auto& binary = static_cast<const BinaryOpNode&>(node);
+                compileExpression(*binary.left);
+                compileExpression(*binary.right);
+                emitOperator(binary.op);
+                break;
+            }
+            case ARRAY_ELEMENT_NODE: {
+                const auto& element = static_cast<const ArrayElementNode&>(node);
+                compileExpression(*element.index);
+                emit(OP_ALOAD, element.array);
+                break;
+            }
+            case ARRAY_SUM_NODE:
+                emit(OP_ASUM, static_cast<const ArraySumNode&>(node).array);
+                push(1);
+                break;
+            case FLAT_EXPRESSION_NODE:
+                // Already in postorder; only the folded leaf operands need their push back.
+                for (const FlatStep& step : static_cast<const FlatExpressionNode&>(node).steps) {
+                    switch (step.code) {
+                        case FlatStep::CONSTANT:
+                        case FlatStep::APPLY_CONSTANT:
+                            emitConstant(step.constant);
+                            break;
+                        case FlatStep::VARIABLE:
+                        case FlatStep::APPLY_VARIABLE:
+                            emit(OP_LOAD, step.slot);
+                            push(1);
+                            break;
+                        case FlatStep::ELEMENT:
+                            emit(OP_ALOAD, step.slot);
+                            break;
+                        case FlatStep::SUM:
+                            emit(OP_ASUM, step.slot);
+                            push(1);
+                            break;
+                        default:
+                            break;
+                    }
+                    if (step.code == FlatStep::APPLY || step.code == FlatStep::APPLY_CONSTANT || step.code == FlatStep::APPLY_VARIABLE) {
+                        emitOperator(step.op);
+                    }
+                }
+                break;
+            default:
+                emit(OP_PUSH, 0);
+                push(1);
+                break;
+        }
+    }
+
+    void emitConstant(Value value) {
+        if (value.isInt() && value.i >= INT_MIN && value.i <= INT_MAX) {
+            emit(OP_PUSH, static_cast<int>(value.i));
+        } else {
+            output.constants.push_back(value);
+            emit(OP_PUSH_CONST, static_cast<int>(output.constants.size() - 1));
+        }
+        push(1);
+    }
+
+    // Pops two operands and pushes the result.
+    void emitOperator(TokenType op) {
+        switch (op) {
+            case PLUS: emit(OP_ADD); break;
+            case MINUS: emit(OP_SUB); break;
+            case MULTIPLY: emit(OP_MUL); break;
+            case DIVIDE: emit(OP_DIV); break;
+            case MOD: emit(OP_MOD); break;
+            case EQUAL: emit(OP_EQ); break;
+            case NOT_EQUAL: emit(OP_NE); break;
+            case LESS: emit(OP_LT); break;
+            case GREATER: emit(OP_GT); break;
+            case LESS_EQUAL: emit(OP_LE); break;
+            case GREATER_EQUAL: emit(OP_GE); break;
+            case AND: emit(OP_AND); break;
+            case OR: emit(OP_OR); break;
+            default:
+                // Mirrors BinaryOpNode, which yields 0 for unknown operators:
+                // left * (right * 0).
+                emit(OP_PUSH, 0);
+                emit(OP_MUL);
+                emit(OP_MUL);
+                push(1);
+                pop(1);
+                break;
+        }
+        pop(1);
+    }
+
+    size_t emit(OpCode op, int operand = 0) {
+        output.code.push_back({op, operand});
+        return output.code.size() - 1;
+    }
+
+    int addLoop(int counter, int limit, int step, size_t targetStatement) {
+        output.loops.push_back({counter, limit, step, 0});
+        loopFixups.emplace_back(output.loops.size() - 1, targetStatement);
+        return static_cast<int>(output.loops.size() - 1);
+    }
+
+    // Points a previously emitted jump at the next instruction.
+    void patch(size_t jump) {
+        Instruction& instruction = output.code[jump];
+        int next = static_cast<int>(output.code.size());
+        if (instruction.op == OP_TEST_EQUAL || instruction.op == OP_TEST_NOT_EQUAL) {
+            output.compares[instruction.operand].target = next;
+        } else {
+            instruction.operand = next;
+        }
+    }
+
+    void push(size_t n) {
+        depth += n;
+        if (depth > output.maxStack) output.maxStack = depth;
+    }
+
+    void pop(size_t n) { depth -= n; }
+
+    bool fuse;
+    Bytecode output;
+    size_t statement = 0;  // Being compiled
+    size_t depth = 0;
+    // (instruction or loop index, target statement index) pairs patched at the end.
+    std::vector<std::pair<size_t, size_t>> jumpFixups;
+    std::vector<std::pair<size_t, size_t>> loopFixups;
+};
+
+// The VM's array instructions, kept out of line so the dispatch loop keeps
+// its registers for ip and sp. Each returns the fault message, or nullptr.
+BASIC_COLD const char* loadElement(Frame& frame, int array, Value& index) {
+    const int* element = arrayElement(frame, array, index);
+    if (!element) return INDEX_OUT_OF_BOUNDS;
+    index = int64_t(*element);
+    return nullptr;
+}
+
+BASIC_COLD const char* storeElement(Frame& frame, int array, Value index, Value value) {
+    int* element = arrayElement(frame, array, index);
+    if (!element) return INDEX_OUT_OF_BOUNDS;
+    if (!fitsElement(value)) return ARRAY_VALUE_RANGE;
+    *element = static_cast<int>(value.i);
+    return nullptr;
+}
+
+// Pops the statement's scalar operands, right first.
+BASIC_COLD const char* arrayStatement(Frame& frame, const ArrayOpInfo& arrayOp, Value*& sp) {
+    Value rightScalar = arrayOp.op != ASSIGN && arrayOp.right < 0 ? *--sp : 0;
+    Value leftScalar = arrayOp.left < 0 ? *--sp : 0;
+    return applyArrayOp(frame, arrayOp.target, arrayOp.op, arrayOp.left, arrayOp.right, leftScalar, rightScalar);
+}
+
+BASIC_COLD Value sumArray(Frame& frame, int array) {
+    const IntArray& values = arrayIn(frame, array);
+    return bestArrayKernels().sum(values.data(), values.size());
+}
+
+// SAVE and LOAD for the VM. Its return addresses are instruction pointers and
+// a snapshot's are statement indices. A GOSUB returns to the first statement
+// starting at or after the instruction behind its call, the same statement
+// the tree-walker returns to.
+BASIC_COLD std::vector<size_t> returnStatements(const BytecodeView& bytecode,
+                                                const std::vector<const Instruction*>& callStack) {
+    const int* starts = bytecode.statementStarts;
+    const int* end = starts + bytecode.statementCount + 1;
+    std::vector<size_t> returnStack;
+    returnStack.reserve(callStack.size());
+    for (const Instruction* target : callStack) {
+        returnStack.push_back(std::lower_bound(starts, end, static_cast<int>(target - bytecode.code)) - starts);
+    }
+    return returnStack;
+}
+
+BASIC_COLD const char* saveState(const BytecodeView& bytecode, const Frame& frame, size_t resume,
+                                 const std::vector<const Instruction*>& callStack, const SnapshotFile& snapshot) {
+    return saveSnapshot(snapshot, frame, resume, returnStatements(bytecode, callStack));
+}
+
+BASIC_COLD const char* loadState(const BytecodeView& bytecode, Frame& frame, size_t& resume,
+                                 std::vector<const Instruction*>& callStack, const SnapshotFile& snapshot) {
+    std::vector<size_t> returnStack = returnStatements(bytecode, callStack);
+    if (const char* error = loadSnapshot(snapshot, frame, resume, returnStack)) return error;
+    callStack.clear();
+    for (size_t target : returnStack) {
+        callStack.push_back(bytecode.code + bytecode.statementStarts[target]);
+    }
+    return nullptr;
+}
+
+// Executes compiled bytecode. Uses computed goto for dispatch where the
+// compiler supports it, and a plain switch loop otherwise.
+#ifndef BASIC_COMPUTED_GOTO
+#if defined(__GNUC__) || defined(__clang__)
+#define BASIC_COMPUTED_GOTO 1
+#else
+#define BASIC_COMPUTED_GOTO 0
+#endif
+#endif
+
+void runBytecode(const BytecodeView& bytecode, Frame& frame, const SymbolTable& symbols, OutputSink& output,
+                 InputSource& input, const SnapshotFile& snapshot) {
+    std::vector<Value> stackStorage(bytecode.maxStack + 1);
+    Value* sp = stackStorage.data();
+    const Instruction* code = bytecode.code;
+    const Instruction* ip = code;
+    const LoopInfo* loops = bytecode.loops;
+    const CompareInfo* compares = bytecode.compares;
+    std::vector<const Instruction*> callStack;
+
+#if BASIC_COMPUTED_GOTO
+    // Must list handlers in OpCode order.
+    static const void* const handlers[] = {
+        &&VM_OP_PUSH, &&VM_OP_PUSH_CONST, &&VM_OP_LOAD, &&VM_OP_STORE, &&VM_OP_ADD, &&VM_OP_SUB,
+        &&VM_OP_MUL, &&VM_OP_DIV, &&VM_OP_MOD, &&VM_OP_EQ, &&VM_OP_NE, &&VM_OP_LT, &&VM_OP_GT,
+        &&VM_OP_LE, &&VM_OP_GE, &&VM_OP_AND, &&VM_OP_OR, &&VM_OP_PRINT,
+        &&VM_OP_INPUT, &&VM_OP_JUMP_IF_ZERO, &&VM_OP_JUMP, &&VM_OP_CALL, &&VM_OP_RETURN,
+        &&VM_OP_FOR_ENTER, &&VM_OP_FOR_NEXT, &&VM_OP_DIM, &&VM_OP_ALOAD, &&VM_OP_ASTORE,
+        &&VM_OP_ARRAY_OP, &&VM_OP_ASUM, &&VM_OP_INC, &&VM_OP_ADD_TO, &&VM_OP_PRINT_VAR, &&VM_OP_TEST_EQUAL,
+        &&VM_OP_TEST_NOT_EQUAL, &&VM_OP_SAVE_STATE, &&VM_OP_LOAD_STATE, &&VM_OP_HALT
+    };
+#define VM_CASE(op) VM_##op
+#define VM_DISPATCH() goto *handlers[ip->op]
+    VM_DISPATCH();
+#else
+#define VM_CASE(op) case op
+#define VM_DISPATCH() continue
+    for (;;) {
+        switch (ip->op) {
+#endif
+    VM_CASE(OP_PUSH):
+        *sp++ = ip->operand;
+        ip++;
+        VM_DISPATCH();
+    VM_CASE(OP_PUSH_CONST):
+        *sp++ = bytecode.constants[ip->operand];
+        ip++;
+        VM_DISPATCH();
+    VM_CASE(OP_LOAD):
+        *sp++ = frame[ip->operand];
+        ip++;
+        VM_DISPATCH();
+    VM_CASE(OP_STORE):
+        frame[ip->operand] = *--sp;
+        ip++;
+        VM_DISPATCH();
+    VM_CASE(OP_ADD):
+        sp--;
+        updateOp<AddOp>(sp[-1], sp[0]);
+        ip++;
+        VM_DISPATCH();
+    VM_CASE(OP_SUB):
+        sp--;
+        updateOp<SubOp>(sp[-1], sp[0]);
+        ip++;
+        VM_DISPATCH();
+    VM_CASE(OP_MUL):
+        sp--;
+        updateOp<MulOp>(sp[-1], sp[0]);
+        ip++;
+        VM_DISPATCH();
+    VM_CASE(OP_DIV):
+        sp--;
+        updateOp<DivOp>(sp[-1], sp[0]);
+        ip++;
+        VM_DISPATCH();
+    VM_CASE(OP_MOD):
+        sp--;
+        updateOp<ModOp>(sp[-1], sp[0]);
+        ip++;
+        VM_DISPATCH();
+    VM_CASE(OP_EQ):
+        sp--;
+        updateOp<EqOp>(sp[-1], sp[0]);
+        ip++;
+        VM_DISPATCH();
+    VM_CASE(OP_NE):
+        sp--;
+        updateOp<NeOp>(sp[-1], sp[0]);
+        ip++;
+        VM_DISPATCH();
+    VM_CASE(OP_LT):
+        sp--;
+        updateOp<LtOp>(sp[-1], sp[0]);
+        ip++;
+        VM_DISPATCH();
+    VM_CASE(OP_GT):
+        sp--;
+        updateOp<GtOp>(sp[-1], sp[0]);
+        ip++;
+        VM_DISPATCH();
+    VM_CASE(OP_LE):
+        sp--;
+        updateOp<LeOp>(sp[-1], sp[0]);
+        ip++;
+        VM_DISPATCH();
+    VM_CASE(OP_GE):
+        sp--;
+        updateOp<GeOp>(sp[-1], sp[0]);
+        ip++;
+        VM_DISPATCH();
+    VM_CASE(OP_AND):
+        sp--;
+        updateOp<AndOp>(sp[-1], sp[0]);
+        ip++;
+        VM_DISPATCH();
+    VM_CASE(OP_OR):
+        sp--;
+        updateOp<OrOp>(sp[-1], sp[0]);
+        ip++;
+        VM_DISPATCH();
+    VM_CASE(OP_PRINT):
+        output.printLine(*--sp);
+        ip++;
+        VM_DISPATCH();
+    VM_CASE(OP_INPUT):
+        frame[ip->operand] = input.read(symbols.name(ip->operand), output);
+        ip++;
+        VM_DISPATCH();
+    VM_CASE(OP_JUMP_IF_ZERO):
+        ip = !(--sp)->isTrue() ? code + ip->operand : ip + 1;
+        VM_DISPATCH();
+    VM_CASE(OP_JUMP):
+        ip = code + ip->operand;
+        VM_DISPATCH();
+    VM_CASE(OP_CALL):
+        callStack.push_back(ip + 1);
+        ip = code + ip->operand;
+        VM_DISPATCH();
+    VM_CASE(OP_RETURN):
+        if (callStack.empty()) {
+            output.write("RETURN without GOSUB!");
+            output.newline();
+            return;
+        }
+        ip = callStack.back();
+        callStack.pop_back();
+        VM_DISPATCH();
+    VM_CASE(OP_FOR_ENTER): {
+        const LoopInfo& loop = loops[ip->operand];
+        ip = forContinues(frame[loop.counter], frame[loop.limit], frame[loop.step]) ? ip + 1 : code + loop.target;
+        VM_DISPATCH();
+    }
+    VM_CASE(OP_FOR_NEXT): {
+        const LoopInfo& loop = loops[ip->operand];
+        Value counter = frame[loop.counter] = AddOp::apply(frame[loop.counter], frame[loop.step]);
+        ip = forContinues(counter, frame[loop.limit], frame[loop.step]) ? code + loop.target : ip + 1;
+        VM_DISPATCH();
+    }
+    VM_CASE(OP_DIM):
+        if (const char* error = dimension(frame, ip->operand, *--sp)) {
+            output.write(error);
+            output.newline();
+            return;
+        }
+        ip++;
+        VM_DISPATCH();
+    VM_CASE(OP_ALOAD):
+        if (const char* error = loadElement(frame, ip->operand, sp[-1])) {
+            output.write(error);
+            output.newline();
+            return;
+        }
+        ip++;
+        VM_DISPATCH();
+    VM_CASE(OP_ASTORE):
+        sp -= 2;
+        if (const char* error = storeElement(frame, ip->operand, sp[0], sp[1])) {
+            output.write(error);
+            output.newline();
+            return;
+        }
+        ip++;
+        VM_DISPATCH();
+    VM_CASE(OP_ARRAY_OP):
+        if (const char* error = arrayStatement(frame, bytecode.arrayOps[ip->operand], sp)) {
+            output.write(error);
+            output.newline();
+            return;
+        }
+        ip++;
+        VM_DISPATCH();
+    VM_CASE(OP_ASUM):
+        *sp++ = sumArray(frame, ip->operand);
+        ip++;
+        VM_DISPATCH();
+    VM_CASE(OP_INC):
+        updateOp<AddOp>(frame[ip->operand], int64_t(1));
+        ip++;
+        VM_DISPATCH();
+    VM_CASE(OP_ADD_TO):
+        updateOp<AddOp>(frame[ip->operand], *--sp);
+        ip++;
+        VM_DISPATCH();
+    VM_CASE(OP_PRINT_VAR):
+        output.printLine(frame[ip->operand]);
+        ip++;
+        VM_DISPATCH();
+    VM_CASE(OP_TEST_EQUAL): {
+        const CompareInfo& test = compares[ip->operand];
+        ip = equalsConstant(frame[test.slot], test.constant) ? ip + 1 : code + test.target;
+        VM_DISPATCH();
+    }
+    VM_CASE(OP_TEST_NOT_EQUAL): {
+        const CompareInfo& test = compares[ip->operand];
+        ip = equalsConstant(frame[test.slot], test.constant) ? code + test.target : ip + 1;
+        VM_DISPATCH();
+    }
+    VM_CASE(OP_SAVE_STATE):
+        if (const char* error = saveState(bytecode, frame, ip->operand, callStack, snapshot)) {
+            output.write(error);
+            output.newline();
+            return;
+        }
+        ip++;
+        VM_DISPATCH();
+    VM_CASE(OP_LOAD_STATE): {
+        size_t resume = ip->operand;
+        if (const char* error = loadState(bytecode, frame, resume, callStack, snapshot)) {
+            output.write(error);
+            output.newline();
+            return;
+        }
+        ip = code + bytecode.statementStarts[resume];
+        VM_DISPATCH();
+    }
+    VM_CASE(OP_HALT):
+        return;
+#if !BASIC_COMPUTED_GOTO
+        }
+    }
+#endif
+#undef VM_CASE
+#undef VM_DISPATCH
+}
+
+// Native JIT for hot assignments (x86-64 Linux only). Statements made of
+// numbers, variables and arithmetic are compiled to a function taking the
+// frame pointer in rdi and computing in rax. The code only handles integers:
+// it checks each variable's tag and sets jo after each add, subtract and
+// multiply, and on anything else (a double, an overflow, or a division by -1,
+// which may overflow) returns 1 before storing anything, so the caller runs
+// the statement on the tree-walker instead. Division uses idiv, so division
+// by zero traps exactly like the interpreter does. Returns 0 when it stored.
+#if defined(__x86_64__) && defined(__linux__)
+#define BASIC_JIT 1
+#include <sys/mman.h>
+#include <cstring>
+#include <cstddef>
+static_assert(sizeof(Value) == 16 && offsetof(Value, tag) == 8, "JIT code assumes this Value layout");
+#else
+#define BASIC_JIT 0
+#endif
+
+using NativeStatement = int (*)(Value* frame);
+
+// Executions of a statement before the JIT compiles it.
+const unsigned JIT_HOT_THRESHOLD = 100;
+
+class JitCompiler {
+public:
+    // Machine code for the assignment, or false if it uses anything unsupported.
+    static bool compileAssignment(const AssignmentNode& assignment, std::vector<uint8_t>& code) {
+        code.clear();
+        std::vector<size_t> bailouts;
+        // A bailout can leave left operands pushed, so the exit restores rsp
+        // from rsi rather than counting them.
+        code.insert(code.end(), {0x48, 0x89, 0xE6}); // mov rsi, rsp
+        if (!compileExpression(*assignment.expression, code, bailouts)) {
+            return false;
+        }
+        int offset = assignment.slot * static_cast<int>(sizeof(Value));
+        code.insert(code.end(), {0x48, 0x89, 0x87}); // mov [rdi + offset], rax
+        emitInt(code, offset);
+        code.insert(code.end(), {0xC6, 0x87});       // mov byte [rdi + offset + 8], INT
+        emitInt(code, offset + 8);
+        code.push_back(Value::INT);
+        code.insert(code.end(), {0x31, 0xC0, 0xC3}); // xor eax, eax; ret
+
+        size_t bail = code.size();
+        for (size_t jump : bailouts) {
+            int distance = static_cast<int>(bail - (jump + 4));
+            std::memcpy(code.data() + jump, &distance, 4);
+        }
+        code.insert(code.end(), {0x48, 0x89, 0xF4});                   // mov rsp, rsi
+        code.insert(code.end(), {0xB8, 0x01, 0x00, 0x00, 0x00, 0xC3}); // mov eax, 1; ret
+        return true;
+    }
+
+private:
+    // Leaves the value in rax. Clobbers rcx and rdx; rsi holds the entry rsp.
+    static bool compileExpression(const ASTNode& node, std::vector<uint8_t>& code, std::vector<size_t>& bailouts) {
+        switch (node.kind) {
+            case NUMBER_NODE:
+                return emitConstant(code, static_cast<const NumberNode&>(node).value, 0);
+            case VARIABLE_NODE:
+                emitLoad(code, static_cast<const VariableNode&>(node).slot, 0, bailouts);
+                return true;
+            case BINARY_OP_NODE: {
+                const auto& binary = static_cast<const BinaryOpNode&>(node);
+                if (!compileExpression(*binary.left, code, bailouts)) return false;
+                // Leaf right operands load straight into rcx; anything else is
+                // computed with the left value saved on the native stack.
+                if (binary.right->kind == NUMBER_NODE) {
+                    if (!emitConstant(code, static_cast<const NumberNode&>(*binary.right).value, 1)) return false;
+                } else if (binary.right->kind == VARIABLE_NODE) {
+                    emitLoad(code, static_cast<const VariableNode&>(*binary.right).slot, 1, bailouts);
+                } else {
+                    code.push_back(0x50);                        // push rax
+                    if (!compileExpression(*binary.right, code, bailouts)) return false;
+                    code.insert(code.end(), {0x48, 0x89, 0xC1}); // mov rcx, rax
+                    code.push_back(0x58);                        // pop rax
+                }
+                switch (binary.op) {
+                    case PLUS:
+                        code.insert(code.end(), {0x48, 0x01, 0xC8});       // add rax, rcx
+                        emitBailout(code, 0x80, bailouts);                  // jo
+                        break;
+                    case MINUS:
+                        code.insert(code.end(), {0x48, 0x29, 0xC8});       // sub rax, rcx
+                        emitBailout(code, 0x80, bailouts);                  // jo
+                        break;
+                    case MULTIPLY:
+                        code.insert(code.end(), {0x48, 0x0F, 0xAF, 0xC1}); // imul rax, rcx
+                        emitBailout(code, 0x80, bailouts);                  // jo
+                        break;
+                    case DIVIDE:
+                    case MOD:
+                        code.insert(code.end(), {0x48, 0x83, 0xF9, 0xFF}); // cmp rcx, -1
+                        emitBailout(code, 0x84, bailouts);                  // je
+                        code.insert(code.end(), {0x48, 0x99, 0x48, 0xF7, 0xF9}); // cqo; idiv rcx
+                        if (binary.op == MOD) code.insert(code.end(), {0x48, 0x89, 0xD0}); // mov rax, rdx
+                        break;
+                    case EQUAL:
+                    case NOT_EQUAL:
+                    case LESS:
+                    case GREATER:
+                    case LESS_EQUAL:
+                    case GREATER_EQUAL:
+                        code.insert(code.end(), {0x48, 0x39, 0xC8, 0x0F, setCondition(binary.op), 0xC0, 0x0F, 0xB6, 0xC0}); // cmp; setcc al; movzx eax, al
+                        break;
+                    case AND:
+                    case OR:
+                        code.insert(code.end(), {0x48, 0x85, 0xC0, 0x0F, 0x95, 0xC0});  // test rax, rax; setne al
+                        code.insert(code.end(), {0x48, 0x85, 0xC9, 0x0F, 0x95, 0xC1});  // test rcx, rcx; setne cl
+                        code.insert(code.end(), {static_cast<uint8_t>(binary.op == AND ? 0x20 : 0x08), 0xC8}); // and/or al, cl
+                        code.insert(code.end(), {0x0F, 0xB6, 0xC0});                    // movzx eax, al
+                        break;
+                    default:
+                        return false;
+                }
+                return true;
+            }
+            default:
+                return false;
+        }
+    }
+
+    // The second opcode byte of the signed setcc for a comparison.
+    static uint8_t setCondition(TokenType op) {
+        switch (op) {
+            case EQUAL: return 0x94;          // sete
+            case NOT_EQUAL: return 0x95;      // setne
+            case LESS: return 0x9C;           // setl
+            case GREATER: return 0x9F;        // setg
+            case LESS_EQUAL: return 0x9E;     // setle
+            default: return 0x9D;             // setge
+        }
+    }
+
+    // mov rax/rcx (reg 0/1), constant. Doubles are left to the interpreter.
+    static bool emitConstant(std::vector<uint8_t>& code, Value value, uint8_t reg) {
+        if (!value.isInt()) return false;
+        if (value.i >= INT_MIN && value.i <= INT_MAX) {
+            code.insert(code.end(), {0x48, 0xC7, static_cast<uint8_t>(0xC0 | reg)}); // mov reg, simm32
+            emitInt(code, static_cast<int>(value.i));
+        } else {
+            code.insert(code.end(), {0x48, static_cast<uint8_t>(0xB8 | reg)});       // mov reg, imm64
+            uint64_t bits = static_cast<uint64_t>(value.i);
+            for (int i = 0; i < 8; i++) code.push_back(static_cast<uint8_t>(bits >> (8 * i)));
+        }
+        return true;
+    }
+
+    // mov rax/rcx (reg 0/1), frame[slot], bailing out unless it holds an integer.
+    static void emitLoad(std::vector<uint8_t>& code, int slot, uint8_t reg, std::vector<size_t>& bailouts) {
+        int offset = slot * static_cast<int>(sizeof(Value));
+        code.insert(code.end(), {0x80, 0xBF}); // cmp byte [rdi + offset + 8], INT
+        emitInt(code, offset + 8);
+        code.push_back(Value::INT);
+        emitBailout(code, 0x85, bailouts);     // jne
+        code.insert(code.end(), {0x48, 0x8B, static_cast<uint8_t>(0x87 | (reg << 3))}); // mov reg, [rdi + offset]
+        emitInt(code, offset);
+    }
+
+    // A conditional jump (0F condition rel32) to the bailout exit, patched
+    // once the exit's position is known.
+    static void emitBailout(std::vector<uint8_t>& code, uint8_t condition, std::vector<size_t>& bailouts) {
+        code.insert(code.end(), {0x0F, condition});
+        bailouts.push_back(code.size());
+        emitInt(code, 0);
+    }
+
+    static void emitInt(std::vector<uint8_t>& code, int value) {
+        uint32_t bits = static_cast<uint32_t>(value);
+        for (int i = 0; i < 4; i++) {
+            code.push_back(static_cast<uint8_t>(bits >> (8 * i)));
+        }
+    }
+};
+
+// Executable memory for JIT output, carved out of mmap'd chunks. Pages are
+// only writable while code is being copied in.
+class JitArena {
+public:
+    JitArena() = default;
+    JitArena(const JitArena&) = delete;
+    JitArena& operator=(const JitArena&) = delete;
+    ~JitArena() { clear(); }
+
+    NativeStatement install(const std::vector<uint8_t>& code) {
+#if BASIC_JIT
+        if (chunks.empty() || chunks.back().used + code.size() > chunks.back().size) {
+            size_t size = std::max<size_t>(CHUNK_SIZE, (code.size() + 4095) & ~size_t(4095));
+            void* memory = mmap(nullptr, size, PROT_READ | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (memory == MAP_FAILED) return nullptr;
+            chunks.push_back({static_cast<uint8_t*>(memory), size, 0});
+        }
+        Chunk& chunk = chunks.back();
+        if (mprotect(chunk.base, chunk.size, PROT_READ | PROT_WRITE) != 0) return nullptr;
+        uint8_t* entry = chunk.base + chunk.used;
+        std::memcpy(entry, code.data(), code.size());
+        chunk.used += (code.size() + 15) & ~size_t(15);
+        if (mprotect(chunk.base, chunk.size, PROT_READ | PROT_EXEC) != 0) return nullptr;
+        return reinterpret_cast<NativeStatement>(entry);
+#else
+        (void)code;
+        return nullptr;
+#endif
+    }
+
+    void clear() {
+#if BASIC_JIT
+        for (const Chunk& chunk : chunks) {
+            munmap(chunk.base, chunk.size);
+        }
+#endif
+        chunks.clear();
+    }
+
+private:
+    static constexpr size_t CHUNK_SIZE = 64 * 1024;
+
+    struct Chunk {
+        uint8_t* base;
+        size_t size;
+        size_t used;
+    };
+    std::vector<Chunk> chunks;
+};
+
+// A bounded queue between exactly one producer thread and one consumer
+// thread. Each side only writes its own index (kept on separate cache lines),
+// so neither push nor pop takes a lock. A side that has to wait spins briefly,
+// then yields, then sleeps, so a stalled pipeline does not burn a core.
+template <typename T>
+class SpscQueue {
+public:
+    explicit SpscQueue(size_t capacity) : slots(roundUpToPowerOfTwo(capacity)), mask(slots.size() - 1) {}
+    SpscQueue(const SpscQueue&) = delete;
+    SpscQueue& operator=(const SpscQueue&) = delete;
+
+    // Producer side. Waits while the queue is full; returns false if the
+    // consumer has closed the queue, in which case the value is dropped.
+    bool push(T&& value) {
+        size_t tail = tailIndex.load(std::memory_order_relaxed);
+        for (unsigned waits = 0; tail - headIndex.load(std::memory_order_acquire) == slots.size(); waits++) {
+            if (closed.load(std::memory_order_acquire)) return false;
+            backOff(waits);
+        }
+        slots[tail & mask] = std::move(value);
+        tailIndex.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Producer side: nothing more is coming.
+    void finish() { finished.store(true, std::memory_order_release); }
+
+    // Consumer side. Waits for the next value; returns false once the
+    // producer has finished and everything it pushed has been taken.
+    bool pop(T& value) {
+        size_t head = headIndex.load(std::memory_order_relaxed);
+        for (unsigned waits = 0; head == tailIndex.load(std::memory_order_acquire); waits++) {
+            if (finished.load(std::memory_order_acquire)) {
+                if (head == tailIndex.load(std::memory_order_acquire)) return false;
+                break;
+            }
+            backOff(waits);
+        }
+        value = std::move(slots[head & mask]);
+        headIndex.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer side: stop the producer at its next push.
+    void close() { closed.store(true, std::memory_order_release); }
+
+private:
+    static size_t roundUpToPowerOfTwo(size_t n) {
+        size_t size = 1;
+        while (size < n) size <<= 1;
+        return size;
+    }
+
+    static void backOff(unsigned waits) {
+        if (waits < 64) return;
+        if (waits < 128) {
+            std::this_thread::yield();
+        } else {
+            std::this_thread::sleep_for(std::chrono::microseconds(50));
+        }
+    }
+
+    std::vector<T> slots;
+    const size_t mask;
+    alignas(64) std::atomic<size_t> headIndex{0};
+    alignas(64) std::atomic<size_t> tailIndex{0};
+    alignas(64) std::atomic<bool> finished{false};
+    std::atomic<bool> closed{false};
+};
+
+// Per-line counters for --profile: how often each statement ran, how long it
+// took and how many AST nodes it evaluated, plus the time spent under each
+// chain of GOSUB calls for a folded-stack (flame graph) file. Times are taken
+// with the time-stamp counter where there is one and scaled to nanoseconds
+// against steady_clock over the whole run.
+class Profiler {
+public:
+    struct Line {
+        uint64_t count = 0;
+        uint64_t ticks = 0;
+        uint64_t nodes = 0;
+    };
+
+    static uint64_t ticks() {
+#if BASIC_X86_SIMD
+        return __builtin_ia32_rdtsc();
+#else
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+    }
+
+    // Called by the run loop before its first statement. Counts carry over
+    // from earlier runs of the same program.
+    void begin(const std::vector<size_t>& statementSourceLines) {
+        if (lines.size() != statementSourceLines.size()) {
+            lines.assign(statementSourceLines.size(), Line());
+            sourceLines = statementSourceLines;
+            contexts.assign(1, Context{0, 0});
+            contextIds.clear();
+            stackTicks.clear();
+        }
+        context = 0;
+        wallStart = std::chrono::steady_clock::now();
+        tickStart = ticks();
+    }
+
+    void end() {
+        wallNanos += std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - wallStart).count();
+        tickTotal += ticks() - tickStart;
+    }
+
+    void record(size_t pc, uint64_t elapsed, uint64_t nodes) {
+        Line& line = lines[pc];
+        line.count++;
+        line.ticks += elapsed;
+        line.nodes += nodes;
+        if (folding) {
+            stackTicks[context * lines.size() + pc] += elapsed;
+        }
+    }
+
+    // A GOSUB at statement pc was taken; later statements run under it.
+    void call(size_t pc) {
+        auto inserted = contextIds.emplace(context * lines.size() + pc, contexts.size());
+        if (inserted.second) {
+            contexts.push_back({context, pc});
+        }
+        context = inserted.first->second;
+    }
+
+    void ret() {
+        context = contexts[context].parent;
+    }
+
+    // Keeps the per-call-chain times needed by writeFolded().
+    void enableFolding() { folding = true; }
+
+    // The hottest lines first, at most limit of them.
+    void report(std::ostream& out, size_t limit) const {
+        double nsPerTick = tickTotal ? wallNanos / tickTotal : 0;
+        uint64_t executed = 0, allTicks = 0;
+        std::vector<size_t> order;
+        for (size_t pc = 0; pc < lines.size(); pc++) {
+            executed += lines[pc].count;
+            allTicks += lines[pc].ticks;
+            if (lines[pc].count) order.push_back(pc);
+        }
+        std::sort(order.begin(), order.end(), [&](size_t a, size_t b) { return lines[a].ticks > lines[b].ticks; });
+
+        char row[128];
+        out << "Profile: " << executed << " statements executed in " << wallNanos / 1e6 << " ms\n";
+        std::snprintf(row, sizeof row, "%8s %12s %12s %7s %10s %12s\n", "line", "count", "time ms", "%time", "ns/exec", "nodes");
+        out << row;
+        for (size_t i = 0; i < order.size() && i < limit; i++) {
+            const Line& line = lines[order[i]];
+            double nanos = line.ticks * nsPerTick;
+            std::snprintf(row, sizeof row, "%8zu %12llu %12.3f %6.1f%% %10.1f %12llu\n", sourceLines[order[i]],
+                          static_cast<unsigned long long>(line.count), nanos / 1e6,
+                          allTicks ? 100.0 * line.ticks / allTicks : 0.0, nanos / line.count,
+                          static_cast<unsigned long long>(line.nodes));
+            out << row;
+        }
+    }
+
+    // One "main;line A;line B;line C nanoseconds" entry per call chain and
+    // statement, the input format of flamegraph.pl and speedscope.
+    bool writeFolded(const std::string& path) const {
+        std::ofstream out(path);
+        double nsPerTick = tickTotal ? wallNanos / tickTotal : 0;
+        for (const auto& entry : stackTicks) {
+            size_t pc = entry.first % lines.size();
+            std::string stack = "line " + std::to_string(sourceLines[pc]);
+            for (size_t id = entry.first / lines.size(); id != 0; id = contexts[id].parent) {
+                stack = "line " + std::to_string(sourceLines[contexts[id].callSite]) + ";" + stack;
+            }
+            out << "main;" << stack << " " << static_cast<unsigned long long>(entry.second * nsPerTick) << "\n";
+        }
+        return static_cast<bool>(out);
+    }
+
+private:
+    // A chain of GOSUB calls: the chain it was made from and the GOSUB.
+    struct Context {
+        size_t parent;
+        size_t callSite;
+    };
+
+    std::vector<Line> lines;
+    std::vector<size_t> sourceLines;
+    bool folding = false;
+    std::vector<Context> contexts;                      // 0 is the main program
+    std::unordered_map<size_t, size_t> contextIds;      // parent * statements + GOSUB -> context
+    std::unordered_map<size_t, uint64_t> stackTicks;    // context * statements + statement -> ticks
+    size_t context = 0;
+    std::chrono::steady_clock::time_point wallStart;
+    uint64_t tickStart = 0;
+    double wallNanos = 0;
+    uint64_t tickTotal = 0;
+};
+
+struct ProgramOptions {
+    bool optimize = false;     // Run the Optimizer over every statement
+    bool fuse = true;          // Fused statements and superinstructions (fuseStatement())
+    std::string snapshotPath;  // Where SAVE and LOAD go; empty to ignore them
+};
+
+// Execution engines. The tree-walker is the reference implementation;
+// NATIVE_JIT is the tree-walker with hot assignments compiled to machine code.
+enum Engine {
+    TREE_WALKER,
+    BYTECODE_VM,
+    NATIVE_JIT
+};
+
+struct LoadError {
+    size_t line; // 1-based source line
+    std::string message;
+};
+
+// A whole program, tokenized and parsed once. The statements are kept so the
+// program can be run any number of times without touching the front end again.
+class Program {
+public:
+    // Parses every line and resolves line numbers and loops to statement
+    // indices. Returns false if anything failed; see errorList().
+    bool load(const std::vector<std::string>& lines, const ProgramOptions& options = {}) {
+        reset();
+        statements.reserve(lines.size());
+        std::vector<Token> tokens;
+        forEachLine(lines, [&](std::string_view text, size_t line) {
+            parseLine(text, line, tokens);
+            return true;
+        });
+        return finishLoad(options);
+    }
+
+    // Same, for a whole source buffer such as a mapped file. Lines are
+    // tokenized in place; the buffer only has to outlive this call.
+    bool load(std::string_view source, const ProgramOptions& options = {}) {
+        reset();
+        std::vector<Token> tokens;
+        forEachLine(source, [&](std::string_view text, size_t line) {
+            parseLine(text, line, tokens);
+            return true;
+        });
+        return finishLoad(options);
+    }
+
+    // Loads the program on a worker thread while this thread runs it, so
+    // execution starts as soon as the first statements are parsed rather than
+    // after the last. Running off the end of what has been parsed so far, or
+    // jumping to a line not parsed yet, waits for the worker. Statements run
+    // in exactly the order they would after load(), and INPUT is only ever
+    // read on this thread. A load error stops the run where it is noticed
+    // (load() would have refused to start it) and the function returns false
+    // with the errors in errorList(). Otherwise the rest of the program is
+    // loaded before returning, so it can be run again like a loaded one.
+    // The bytecode VM needs the whole program up front, so it just loads first.
+    template <typename Source>
+    bool runWhileLoading(const Source& source, const ProgramOptions& options, Frame& frame, Engine engine,
+                         OutputSink& output, InputSource& input) {
+        if (engine == BYTECODE_VM) {
+            if (!load(source, options)) return false;
+            frame = newFrame();
+            run(frame, engine, output, input);
+            return true;
+        }
+
+        reset();
+        hitCounts.clear();
+        nativeCode.clear();
+        SpscQueue<ParsedStatement> queue(PIPELINE_DEPTH);
+        std::thread worker([&] { parseAhead(source, options, queue); });
+
+        Linker linker;
+        RunState state{frame, {}, output, input};
+        bool loading = true;
+        size_t pc = 0;
+        try {
+            while (errors.empty()) {
+                if (pc < statements.size()) {
+                    if (loading && usesSnapshot(*statements[pc])) {
+                        // A snapshot holds the whole program's state, so the
+                        // rest of the program has to be here first.
+                        while (loading && errors.empty()) {
+                            loading = receive(queue, frame, linker);
+                        }
+                        if (!errors.empty()) break;
+                        frame.resize(symbols.size(), 0);
+                        frame.arrays.resize(std::max(frame.arrays.size(), symbols.arrayCount()));
+                        setSnapshot(options);
+                    }
+                    size_t next = engine == NATIVE_JIT ? stepNative(pc, state) : execute(*statements[pc], pc, state);
+                    if (next == UNRESOLVED_TARGET) {
+                        // The jump just taken goes somewhere not parsed yet.
+                        size_t& target = pendingTarget(*statements[pc], frame);
+                        while (target == UNRESOLVED_TARGET && loading && errors.empty()) {
+                            loading = receive(queue, frame, linker);
+                        }
+                        if (target == UNRESOLVED_TARGET) break; // Reported below
+                        next = target;
+                    }
+                    pc = next;
+                } else if (pc == statements.size() && loading) {
+                    loading = receive(queue, frame, linker);
+                } else {
+                    break;
+                }
+            }
+        } catch (const RuntimeError& error) {
+            report(error, output);
+        }
+
+        while (loading && errors.empty()) {
+            loading = receive(queue, frame, linker);
+        }
+        queue.close();
+        worker.join();
+        frame.resize(symbols.size(), 0);
+        frame.arrays.resize(std::max(frame.arrays.size(), symbols.arrayCount()));
+        if (!errors.empty()) {
+            return false;
+        }
+        finishLinking(linker);
+        if (!errors.empty()) {
+            std::stable_sort(errors.begin(), errors.end(),
+                             [](const LoadError& a, const LoadError& b) { return a.line < b.line; });
+            return false;
+        }
+        BytecodeCompiler compiler(options.fuse);
+        bytecode = compiler.compile(statements);
+        setSnapshot(options);
+        return true;
+    }
+
+    // A zeroed frame with one slot per variable the program mentions, and
+    // every array empty until its DIM runs.
+    Frame newFrame() const {
+        Frame frame(symbols.size(), 0);
+        frame.arrays.resize(symbols.arrayCount());
+        return frame;
+    }
+
+    // With a profiler, the tree-walker (or JIT) runs through a separate loop
+    // that times every statement; the VM is not profiled.
+    void run(Frame& frame, Engine engine, OutputSink& output, InputSource& input, Profiler* profiler = nullptr) {
+        if (profiler) {
+            runProfiled(frame, engine == NATIVE_JIT ? NATIVE_JIT : TREE_WALKER, output, input, *profiler);
+            return;
+        }
+        if (engine == BYTECODE_VM) {
+            runBytecode(bytecode.view(), frame, symbols, output, input, snapshot);
+            return;
+        }
+        RunState state{frame, {}, output, input};
+        size_t pc = 0;
+        try {
+            if (engine == NATIVE_JIT) {
+                // Native code and hit counts survive between runs of the same program.
+                while (pc < statements.size()) {
+                    pc = stepNative(pc, state);
+                }
+                return;
+            }
+            while (pc < statements.size()) {
+                pc = execute(*statements[pc], pc, state);
+            }
+        } catch (const RuntimeError& error) {
+            report(error, output);
+        }
+    }
+
+    const SymbolTable& symbolTable() const { return symbols; }
+    const Bytecode& compiled() const { return bytecode; }
+    size_t optimizedNodes() const { return nodesRemoved; }
+    size_t reusedValues() const { return valuesReused; }
+    size_t deadStores() const { return storesRemoved; }
+    const std::vector<LoadError>& errorList() const { return errors; }
+    size_t size() const { return statements.size(); }
+
+private:
+    void reset() {
+        statements.clear();
+        sourceLines.clear();
+        lineIndex.clear();
+        errors.clear();
+        nodesRemoved = 0;
+        valuesReused = 0;
+        storesRemoved = 0;
+        jitArena.clear();
+        symbols = SymbolTable();
+    }
+
+    // Calls visit(text, lineNumber) for each line, with any '\r' before the
+    // '\n' removed, until it returns false.
+    template <typename Visit>
+    static void forEachLine(std::string_view source, Visit visit) {
+        size_t line = 0;
+        while (!source.empty()) {
+            size_t end = source.find('\n');
+            std::string_view text = source.substr(0, end);
+            if (!text.empty() && text.back() == '\r') {
+                text.remove_suffix(1);
+            }
+            if (!visit(text, ++line) || end == std::string_view::npos) {
+                break;
+            }
+            source.remove_prefix(end + 1);
+        }
+    }
+
+    template <typename Visit>
+    static void forEachLine(const std::vector<std::string>& lines, Visit visit) {
+        for (size_t i = 0; i < lines.size(); i++) {
+            if (!visit(lines[i], i + 1)) break;
+        }
+    }
+
+    static bool isBlank(const std::vector<Token>& tokens) {
+        return tokens.size() == 1 && tokens[0].text.empty();
+    }
+
+    void parseLine(std::string_view text, size_t line, std::vector<Token>& tokens) {
+        Tokenizer tokenizer(text);
+        tokenizer.tokenize(tokens);
+        if (isBlank(tokens)) {
+            return;
+        }
+
+        Parser parser(tokens, symbols);
+        std::unique_ptr<ASTNode> ast = parser.parse();
+        if (!ast) {
+            errors.push_back({line, "Syntax error"});
+            return;
+        }
+        if (parser.lineNumber() >= 0 && !lineIndex.emplace(parser.lineNumber(), statements.size()).second) {
+            errors.push_back({line, "Duplicate line number"});
+        }
+        statements.push_back(std::move(ast));
+        sourceLines.push_back(line);
+    }
+
+    bool finishLoad(const ProgramOptions& options) {
+        if (!errors.empty()) {
+            return false;
+        }
+        if (options.optimize) {
+            optimize();
+        }
+        if (!resolve()) {
+            return false;
+        }
+        if (options.optimize) {
+            optimizeBlocks();
+        }
+        if (options.fuse) {
+            for (auto& statement : statements) {
+                statement = fuseStatement(std::move(statement));
+            }
+        }
+        BytecodeCompiler compiler(options.fuse);
+        bytecode = compiler.compile(statements);
+        setSnapshot(options);
+        hitCounts.assign(statements.size(), 0);
+        nativeCode.assign(statements.size(), nullptr);
+        return true;
+    }
+
+    void setSnapshot(const ProgramOptions& options) {
+        snapshot = {options.snapshotPath, programFingerprint(symbols, statements.size()), statements.size()};
+    }
+
+    static bool usesSnapshot(const ASTNode& node) {
+        if (node.kind == IF_ELSE_NODE) {
+            const auto& ifElse = static_cast<const IfElseNode&>(node);
+            return usesSnapshot(*ifElse.thenBranch) || (ifElse.elseBranch && usesSnapshot(*ifElse.elseBranch));
+        }
+        return node.kind == SAVE_NODE || node.kind == LOAD_NODE;
+    }
+
+    static void report(const RuntimeError& error, OutputSink& output) {
+        output.write(error.message);
+        output.newline();
+    }
+
+    // Everything one run of the tree-walker touches besides the statements.
+    struct RunState {
+        Frame& frame;
+        std::vector<size_t> returnStack;
+        OutputSink& output;
+        InputSource& input;
+    };
+
+    // Executes one statement and returns the index of the next one to run.
+    size_t execute(ASTNode& node, size_t pc, RunState& state) {
+        Frame& frame = state.frame;
+        switch (node.kind) {
+            case PRINT_NODE: {
+                auto& print = static_cast<PrintNode&>(node);
+                state.output.printLine(print.slot >= 0 ? frame[print.slot] : print.expression->evaluate(frame));
+                return pc + 1;
+            }
+            case INPUT_NODE: {
+                auto& input = static_cast<InputNode&>(node);
+                frame[input.slot] = state.input.read(input.variable, state.output);
+                return pc + 1;
+            }
+            case IF_ELSE_NODE: {
+                auto& ifElse = static_cast<IfElseNode&>(node);
+                if (ifElse.test.slot >= 0 ? ifElse.test.passes(frame) : ifElse.condition->evaluate(frame).isTrue()) {
+                    return execute(*ifElse.thenBranch, pc, state);
+                } else if (ifElse.elseBranch) {
+                    return execute(*ifElse.elseBranch, pc, state);
+                }
+                return pc + 1;
+            }
+            case GOTO_NODE:
+                return static_cast<GotoNode&>(node).target;
+            case GOSUB_NODE:
+                state.returnStack.push_back(pc + 1);
+                return static_cast<GotoNode&>(node).target;
+            case RETURN_NODE: {
+                if (state.returnStack.empty()) {
+                    state.output.write("RETURN without GOSUB!");
+                    state.output.newline();
+                    return END_OF_PROGRAM;
+                }
+                size_t target = state.returnStack.back();
+                state.returnStack.pop_back();
+                return target;
+            }
+            case END_NODE:
+                return END_OF_PROGRAM;
+            case SAVE_NODE:
+            case LOAD_NODE:
+                return executeSnapshot(node.kind, pc, state);
+            case FOR_NODE: {
+                auto& loop = static_cast<ForNode&>(node);
+                frame[loop.slot] = loop.start->evaluate(frame);
+                frame[loop.limitSlot] = loop.limit->evaluate(frame);
+                frame[loop.stepSlot] = loop.step ? loop.step->evaluate(frame) : 1;
+                return forContinues(frame[loop.slot], frame[loop.limitSlot], frame[loop.stepSlot]) ? pc + 1 : loop.exitTarget;
+            }
+            case NEXT_NODE: {
+                auto& next = static_cast<NextNode&>(node);
+                Value counter = frame[next.slot] = AddOp::apply(frame[next.slot], frame[next.stepSlot]);
+                return forContinues(counter, frame[next.limitSlot], frame[next.stepSlot]) ? next.bodyTarget : pc + 1;
+            }
+            case WHILE_NODE: {
+                auto& loop = static_cast<WhileNode&>(node);
+                return loop.condition->evaluate(frame).isTrue() ? pc + 1 : loop.exitTarget;
+            }
+            case WEND_NODE:
+                return static_cast<WendNode&>(node).loopTarget;
+            default:
+                node.evaluate(frame);
+                return pc + 1;
+        }
+    }
+
+    // SAVE continues at the next statement; so does LOAD without a snapshot.
+    BASIC_COLD size_t executeSnapshot(NodeKind kind, size_t pc, RunState& state) {
+        size_t resume = pc + 1;
+        const char* error = kind == SAVE_NODE ? saveSnapshot(snapshot, state.frame, resume, state.returnStack)
+                                              : loadSnapshot(snapshot, state.frame, resume, state.returnStack);
+        if (error) throw RuntimeError{error};
+        return resume;
+    }
+
+    void compileNative(size_t pc) {
+        std::vector<uint8_t> code;
+        if (JitCompiler::compileAssignment(static_cast<AssignmentNode&>(*statements[pc]), code)) {
+            nativeCode[pc] = jitArena.install(code);
+        }
+    }
+
+    void optimize() {
+        Optimizer optimizer;
+        std::vector<std::unique_ptr<ASTNode>> kept;
+        std::vector<size_t> keptLines;
+        // Old statement index -> new one. A removed statement maps to whatever
+        // follows it, so a GOTO to its line lands where execution would have.
+        std::vector<size_t> remap(statements.size() + 1);
+        kept.reserve(statements.size());
+        for (size_t i = 0; i < statements.size(); i++) {
+            remap[i] = kept.size();
+            if (auto optimized = optimizer.optimizeStatement(std::move(statements[i]))) {
+                kept.push_back(std::move(optimized));
+                keptLines.push_back(sourceLines[i]);
+            }
+        }
+        remap[statements.size()] = kept.size();
+        for (auto& entry : lineIndex) {
+            entry.second = remap[entry.second];
+        }
+        statements = std::move(kept);
+        sourceLines = std::move(keptLines);
+        nodesRemoved = optimizer.removedNodes();
+    }
+
+    // Runs the BlockOptimizer over every straight-line block. This comes after
+    // resolve(), on statement indices: its temporaries then follow the FOR
+    // loops', so a -O run's variables keep the slots of a plain run.
+    void optimizeBlocks() {
+        std::vector<char> targets(statements.size() + 1, 0);
+        for (const auto& statement : statements) {
+            markTargets(*statement, targets);
+        }
+        BlockOptimizer optimizer(symbols);
+        std::vector<std::unique_ptr<ASTNode>> kept;
+        std::vector<size_t> keptLines;
+        std::vector<size_t> remap(statements.size() + 1);
+        kept.reserve(statements.size());
+        for (size_t start = 0; start < statements.size();) {
+            size_t end = start + 1;
+            if (!BlockOptimizer::inBlock(*statements[start])) {
+                remap[start] = kept.size();
+                kept.push_back(std::move(statements[start]));
+                keptLines.push_back(sourceLines[start]);
+                start = end;
+                continue;
+            }
+            while (end < statements.size() && BlockOptimizer::inBlock(*statements[end]) && !targets[end]) {
+                end++;
+            }
+            std::vector<std::unique_ptr<ASTNode>> block(std::make_move_iterator(statements.begin() + start),
+                                                        std::make_move_iterator(statements.begin() + end));
+            auto rewritten = optimizer.optimize(std::move(block));
+            for (size_t i = 0; i < rewritten.size(); i++) {
+                // A jump to a statement lands on the temporaries it computes first.
+                remap[start + i] = kept.size();
+                for (auto& statement : rewritten[i]) {
+                    kept.push_back(std::move(statement));
+                    keptLines.push_back(sourceLines[start + i]);
+                }
+            }
+            start = end;
+        }
+        remap[statements.size()] = kept.size();
+        for (auto& statement : kept) {
+            retarget(*statement, remap);
+        }
+        for (auto& entry : lineIndex) {
+            entry.second = remap[entry.second];
+        }
+        statements = std::move(kept);
+        sourceLines = std::move(keptLines);
+        nodesRemoved += optimizer.removedNodes();
+        valuesReused = optimizer.reusedValues();
+        storesRemoved = optimizer.deadStores();
+    }
+
+    // Flags every statement a resolved jump can land on.
+    static void markTargets(const ASTNode& node, std::vector<char>& targets) {
+        switch (node.kind) {
+            case IF_ELSE_NODE: {
+                const auto& ifElse = static_cast<const IfElseNode&>(node);
+                markTargets(*ifElse.thenBranch, targets);
+                if (ifElse.elseBranch) markTargets(*ifElse.elseBranch, targets);
+                break;
+            }
+            case GOTO_NODE:
+            case GOSUB_NODE:
+                targets[static_cast<const GotoNode&>(node).target] = 1;
+                break;
+            case FOR_NODE:
+                targets[static_cast<const ForNode&>(node).exitTarget] = 1;
+                break;
+            case NEXT_NODE:
+                targets[static_cast<const NextNode&>(node).bodyTarget] = 1;
+                break;
+            case WHILE_NODE:
+                targets[static_cast<const WhileNode&>(node).exitTarget] = 1;
+                break;
+            case WEND_NODE:
+                targets[static_cast<const WendNode&>(node).loopTarget] = 1;
+                break;
+            default:
+                break;
+        }
+    }
+
+    static void retarget(ASTNode& node, const std::vector<size_t>& remap) {
+        switch (node.kind) {
+            case IF_ELSE_NODE: {
+                auto& ifElse = static_cast<IfElseNode&>(node);
+                retarget(*ifElse.thenBranch, remap);
+                if (ifElse.elseBranch) retarget(*ifElse.elseBranch, remap);
+                break;
+            }
+            case GOTO_NODE:
+            case GOSUB_NODE: {
+                auto& jump = static_cast<GotoNode&>(node);
+                jump.target = remap[jump.target];
+                break;
+            }
+            case FOR_NODE: {
+                auto& loop = static_cast<ForNode&>(node);
+                loop.exitTarget = remap[loop.exitTarget];
+                break;
+            }
+            case NEXT_NODE: {
+                auto& next = static_cast<NextNode&>(node);
+                next.bodyTarget = remap[next.bodyTarget];
+                break;
+            }
+            case WHILE_NODE: {
+                auto& loop = static_cast<WhileNode&>(node);
+                loop.exitTarget = remap[loop.exitTarget];
+                break;
+            }
+            case WEND_NODE: {
+                auto& wend = static_cast<WendNode&>(node);
+                wend.loopTarget = remap[wend.loopTarget];
+                break;
+            }
+            default:
+                break;
+        }
+    }
+
+    // Turns line numbers into statement indices and pairs FOR/NEXT and
+    // WHILE/WEND, so every control transfer at run time is a direct jump.
+    bool resolve() {
+        std::vector<size_t> openLoops;
+        for (size_t i = 0; i < statements.size(); i++) {
+            resolveJumps(*statements[i], i, nullptr);
+            linkLoop(i, openLoops);
+        }
+        reportOpenLoops(openLoops);
+        return errors.empty();
+    }
+
+    // Pairs statement i with the loop it closes, or opens a loop. A loop's
+    // exit target stays unresolved until its NEXT or WEND has been seen.
+    void linkLoop(size_t i, std::vector<size_t>& openLoops) {
+        ASTNode& node = *statements[i];
+        if (node.kind == FOR_NODE) {
+            auto& loop = static_cast<ForNode&>(node);
+            if (loop.limitSlot < 0) {
+                loop.limitSlot = symbols.temporary();
+                loop.stepSlot = symbols.temporary();
+            }
+            openLoops.push_back(i);
+        } else if (node.kind == WHILE_NODE) {
+            openLoops.push_back(i);
+        } else if (node.kind == NEXT_NODE) {
+            auto& next = static_cast<NextNode&>(node);
+            if (openLoops.empty() || statements[openLoops.back()]->kind != FOR_NODE
+                || (next.slot >= 0 && next.slot != static_cast<ForNode&>(*statements[openLoops.back()]).slot)) {
+                errors.push_back({sourceLines[i], "NEXT without FOR"});
+                return;
+            }
+            auto& loop = static_cast<ForNode&>(*statements[openLoops.back()]);
+            next.slot = loop.slot;
+            next.limitSlot = loop.limitSlot;
+            next.stepSlot = loop.stepSlot;
+            next.bodyTarget = openLoops.back() + 1;
+            loop.exitTarget = i + 1;
+            openLoops.pop_back();
+        } else if (node.kind == WEND_NODE) {
+            if (openLoops.empty() || statements[openLoops.back()]->kind != WHILE_NODE) {
+                errors.push_back({sourceLines[i], "WEND without WHILE"});
+                return;
+            }
+            static_cast<WendNode&>(node).loopTarget = openLoops.back();
+            static_cast<WhileNode&>(*statements[openLoops.back()]).exitTarget = i + 1;
+            openLoops.pop_back();
+        }
+    }
+
+    void reportOpenLoops(const std::vector<size_t>& openLoops) {
+        for (size_t open : openLoops) {
+            errors.push_back({sourceLines[open], statements[open]->kind == FOR_NODE ? "FOR without NEXT" : "WHILE without WEND"});
+        }
+    }
+
+    // Resolves the GOTO/GOSUB targets in a statement. A line that is not
+    // known is an error, unless pending is given: then the jump waits there
+    // for the line to be loaded.
+    struct PendingJump {
+        GotoNode* jump;
+        size_t sourceLine;
+    };
+    using PendingJumps = std::unordered_multimap<int, PendingJump>;
+
+    void resolveJumps(ASTNode& node, size_t index, PendingJumps* pending) {
+        if (node.kind == IF_ELSE_NODE) {
+            auto& ifElse = static_cast<IfElseNode&>(node);
+            resolveJumps(*ifElse.thenBranch, index, pending);
+            if (ifElse.elseBranch) resolveJumps(*ifElse.elseBranch, index, pending);
+        } else if (node.kind == GOTO_NODE || node.kind == GOSUB_NODE) {
+            auto& jump = static_cast<GotoNode&>(node);
+            auto it = lineIndex.find(jump.line);
+            if (it != lineIndex.end()) {
+                jump.target = it->second;
+            } else if (pending) {
+                pending->emplace(jump.line, PendingJump{&jump, sourceLines[index]});
+            } else {
+                errors.push_back({sourceLines[index], "Undefined line number " + std::to_string(jump.line)});
+            }
+        }
+    }
+
+    // One statement on the JIT engine: native code if it has been compiled,
+    // otherwise the tree-walker, counting how often assignments run.
+    size_t stepNative(size_t pc, RunState& state) {
+        NativeStatement native = nativeCode[pc];
+        if (native && native(state.frame.data()) == 0) {
+            return pc + 1;
+        }
+        if (statements[pc]->kind == ASSIGNMENT_NODE && ++hitCounts[pc] == JIT_HOT_THRESHOLD) {
+            compileNative(pc);
+        }
+        return execute(*statements[pc], pc, state);
+    }
+
+    void runProfiled(Frame& frame, Engine engine, OutputSink& output, InputSource& input, Profiler& profiler) {
+        RunState state{frame, {}, output, input};
+        profiler.begin(sourceLines);
+        std::vector<uint64_t> treeSizes(statements.size());
+        for (size_t i = 0; i < statements.size(); i++) {
+            treeSizes[i] = countNodes(*statements[i]);
+        }
+        size_t pc = 0;
+        try {
+            while (pc < statements.size()) {
+                ASTNode& node = *statements[pc];
+                // Counted before the statement can change the frame.
+                uint64_t nodes = node.kind == IF_ELSE_NODE ? evaluatedNodes(node, frame) : treeSizes[pc];
+                size_t depth = state.returnStack.size();
+                uint64_t start = Profiler::ticks();
+                size_t next = engine == NATIVE_JIT ? stepNative(pc, state) : execute(node, pc, state);
+                profiler.record(pc, Profiler::ticks() - start, nodes);
+                if (state.returnStack.size() > depth) {
+                    profiler.call(pc);
+                } else if (state.returnStack.size() < depth) {
+                    profiler.ret();
+                }
+                pc = next;
+            }
+        } catch (const RuntimeError& error) {
+            report(error, output);
+        }
+        profiler.end();
+    }
+
+    // Nodes one execution of a statement evaluates: only the branch an IF
+    // takes counts.
+    static uint64_t evaluatedNodes(ASTNode& node, Frame& frame) {
+        if (node.kind != IF_ELSE_NODE) {
+            return countNodes(node);
+        }
+        auto& ifElse = static_cast<IfElseNode&>(node);
+        uint64_t nodes = 1 + countNodes(*ifElse.condition);
+        if (ifElse.condition->evaluate(frame).isTrue()) {
+            return nodes + evaluatedNodes(*ifElse.thenBranch, frame);
+        }
+        return nodes + (ifElse.elseBranch ? evaluatedNodes(*ifElse.elseBranch, frame) : 0);
+    }
+
+    // The target field a statement just jumped through, found by taking the
+    // same path through it again. Conditions have no side effects, so
+    // evaluating one twice is harmless.
+    size_t& pendingTarget(ASTNode& node, Frame& frame) {
+        switch (node.kind) {
+            case IF_ELSE_NODE: {
+                auto& ifElse = static_cast<IfElseNode&>(node);
+                return pendingTarget(ifElse.condition->evaluate(frame).isTrue() ? *ifElse.thenBranch : *ifElse.elseBranch, frame);
+            }
+            case FOR_NODE:
+                return static_cast<ForNode&>(node).exitTarget;
+            case WHILE_NODE:
+                return static_cast<WhileNode&>(node).exitTarget;
+            default:
+                return static_cast<GotoNode&>(node).target;
+        }
+    }
+
+    // A statement as the load worker hands it to the running thread.
+    struct ParsedStatement {
+        std::unique_ptr<ASTNode> node;  // Null if the optimizer removed the statement
+        size_t sourceLine = 0;
+        int lineNumber = -1;
+        size_t slots = 0;               // Frame slots in use once this statement was parsed
+        size_t arrays = 0;              // Likewise for arrays
+        bool syntaxError = false;
+    };
+
+    // Statements parsed ahead of execution, at most.
+    static const size_t PIPELINE_DEPTH = 4096;
+
+    // The load worker. It owns the symbol table until it finishes; everything
+    // else about the program belongs to the running thread.
+    template <typename Source>
+    void parseAhead(const Source& source, const ProgramOptions& options, SpscQueue<ParsedStatement>& queue) {
+        std::vector<Token> tokens;
+        Optimizer optimizer;
+        forEachLine(source, [&](std::string_view text, size_t line) {
+            Tokenizer tokenizer(text);
+            tokenizer.tokenize(tokens);
+            if (isBlank(tokens)) {
+                return true;
+            }
+            Parser parser(tokens, symbols);
+            ParsedStatement parsed;
+            parsed.sourceLine = line;
+            parsed.node = parser.parse();
+            parsed.syntaxError = !parsed.node;
+            if (parsed.node) {
+                parsed.lineNumber = parser.lineNumber();
+                if (parsed.node->kind == FOR_NODE) {
+                    // Allocated here since the running thread cannot touch the symbols.
+                    auto& loop = static_cast<ForNode&>(*parsed.node);
+                    loop.limitSlot = symbols.temporary();
+                    loop.stepSlot = symbols.temporary();
+                }
+                if (options.optimize) {
+                    parsed.node = optimizer.optimizeStatement(std::move(parsed.node));
+                }
+                if (options.fuse && parsed.node) {
+                    parsed.node = fuseStatement(std::move(parsed.node));
+                }
+            }
+            parsed.slots = symbols.size();
+            parsed.arrays = symbols.arrayCount();
+            return queue.push(std::move(parsed));
+        });
+        nodesRemoved = optimizer.removedNodes();
+        queue.finish();
+    }
+
+    // What the running thread knows about control flow while statements are
+    // still arriving.
+    struct Linker {
+        std::vector<size_t> openLoops;
+        PendingJumps pendingJumps;   // BASIC line number -> jumps waiting for it
+    };
+
+    // Takes the next statement from the load worker and links it into the
+    // program. Returns false once the worker has nothing more.
+    bool receive(SpscQueue<ParsedStatement>& queue, Frame& frame, Linker& linker) {
+        ParsedStatement parsed;
+        if (!queue.pop(parsed)) {
+            return false;
+        }
+        if (parsed.syntaxError) {
+            errors.push_back({parsed.sourceLine, "Syntax error"});
+            return true;
+        }
+        if (parsed.slots > frame.size()) {
+            frame.resize(parsed.slots, 0);
+        }
+        if (parsed.arrays > frame.arrays.size()) {
+            frame.arrays.resize(parsed.arrays);
+        }
+        size_t index = statements.size();
+        if (parsed.lineNumber >= 0) {
+            if (!lineIndex.emplace(parsed.lineNumber, index).second) {
+                errors.push_back({parsed.sourceLine, "Duplicate line number"});
+            }
+            auto waiting = linker.pendingJumps.equal_range(parsed.lineNumber);
+            for (auto it = waiting.first; it != waiting.second; ++it) {
+                it->second.jump->target = index;
+            }
+            linker.pendingJumps.erase(waiting.first, waiting.second);
+        }
+        if (parsed.node) {
+            statements.push_back(std::move(parsed.node));
+            sourceLines.push_back(parsed.sourceLine);
+            hitCounts.push_back(0);
+            nativeCode.push_back(nullptr);
+            resolveJumps(*statements[index], index, &linker.pendingJumps);
+            linkLoop(index, linker.openLoops);
+        }
+        return true;
+    }
+
+    // Everything still waiting once the whole program has arrived is an error.
+    void finishLinking(Linker& linker) {
+        for (const auto& waiting : linker.pendingJumps) {
+            errors.push_back({waiting.second.sourceLine, "Undefined line number " + std::to_string(waiting.first)});
+        }
+        reportOpenLoops(linker.openLoops);
+    }
+    SymbolTable symbols;
+    std::vector<std::unique_ptr<ASTNode>> statements;
+    std::vector<size_t> sourceLines;              // Statement index -> source line
+    std::unordered_map<int, size_t> lineIndex;    // BASIC line number -> statement index
+    Bytecode bytecode;
+    std::vector<LoadError> errors;
+    SnapshotFile snapshot;
+    size_t nodesRemoved = 0;
+    size_t valuesReused = 0;                      // By optimizeBlocks()
+    size_t storesRemoved = 0;
+    std::vector<unsigned> hitCounts;              // Per statement, for the JIT
+    std::vector<NativeStatement> nativeCode;      // Per statement, null until compiled
+    JitArena jitArena;
+};
+
+// A program compiled ahead of time by --compile, so later runs skip the front
+// end. The image holds the bytecode and the variable and array names behind a
+// header that ties it to its source. Every section is an array of fixed-size
+// records at a known offset, with offsets rather than pointers inside, so the
+// VM runs a mapped image in place. An image is stale when it was written by
+// another version of this interpreter, with other options, or from other
+// source; open() refuses it and the caller rebuilds it.
+class ProgramImage {
+public:
+    static bool write(const std::string& path, const Program& program, uint64_t sourceHash, const ProgramOptions& options) {
+        const Bytecode& bytecode = program.compiled();
+        const SymbolTable& symbols = program.symbolTable();
+        std::string names;
+        for (size_t slot = 0; slot < symbols.size(); slot++) {
+            names += symbols.name(static_cast<int>(slot));
+            names += '\0';
+        }
+        for (size_t array = 0; array < symbols.arrayCount(); array++) {
+            names += symbols.arrayName(static_cast<int>(array));
+            names += '\0';
+        }
+
+        std::string body;
+        for (const Value& constant : bytecode.constants) append(body, constant, &Value::i, &Value::tag);
+        for (const Instruction& instruction : bytecode.code) {
+            append(body, instruction, &Instruction::op, &Instruction::operand);
+        }
+        for (const LoopInfo& loop : bytecode.loops) {
+            append(body, loop, &LoopInfo::counter, &LoopInfo::limit, &LoopInfo::step, &LoopInfo::target);
+        }
+        for (const ArrayOpInfo& arrayOp : bytecode.arrayOps) {
+            append(body, arrayOp, &ArrayOpInfo::target, &ArrayOpInfo::op, &ArrayOpInfo::left, &ArrayOpInfo::right);
+        }
+        for (const CompareInfo& compare : bytecode.compares) {
+            append(body, compare, &CompareInfo::slot, &CompareInfo::target, &CompareInfo::constant);
+        }
+        body.append(reinterpret_cast<const char*>(bytecode.statementStarts.data()),
+                    bytecode.statementStarts.size() * sizeof(int));
+        body += names;
+
+        Header header;
+        std::memcpy(header.magic, MAGIC, sizeof(header.magic));
+        header.version = VERSION;
+        header.flags = imageFlags(options);
+        header.sourceHash = sourceHash;
+        header.checksum = hashBytes(body);
+        header.size = sizeof(Header) + body.size();
+        header.constantCount = static_cast<uint32_t>(bytecode.constants.size());
+        header.codeCount = static_cast<uint32_t>(bytecode.code.size());
+        header.loopCount = static_cast<uint32_t>(bytecode.loops.size());
+        header.arrayOpCount = static_cast<uint32_t>(bytecode.arrayOps.size());
+        header.variableCount = static_cast<uint32_t>(symbols.size());
+        header.arrayCount = static_cast<uint32_t>(symbols.arrayCount());
+        header.namesBytes = static_cast<uint32_t>(names.size());
+        header.maxStack = static_cast<uint32_t>(bytecode.maxStack);
+        header.compareCount = static_cast<uint32_t>(bytecode.compares.size());
+        header.statementCount = static_cast<uint32_t>(bytecode.statementStarts.size() - 1);
+
+        // Written next to the image and renamed over it, so a reader never
+        // maps a half-written file.
+        std::string temporary = path + ".tmp";
+        {
+            std::ofstream file(temporary, std::ios::binary | std::ios::trunc);
+            file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+            file.write(body.data(), static_cast<std::streamsize>(body.size()));
+            if (!file) {
+                std::remove(temporary.c_str());
+                return false;
+            }
+        }
+        return std::rename(temporary.c_str(), path.c_str()) == 0;
+    }
+
+    // Maps the image. False if it is missing, damaged or stale.
+    bool open(const std::string& path, uint64_t sourceHash, const ProgramOptions& options) {
+        if (!file.open(path)) return false;
+        std::string_view image = file.data();
+        if (image.size() < sizeof(Header)) return false;
+        const Header& header = *reinterpret_cast<const Header*>(image.data());
+        if (std::memcmp(header.magic, MAGIC, sizeof(header.magic)) != 0 || header.version != VERSION
+            || header.flags != imageFlags(options) || header.sourceHash != sourceHash
+            || header.size != image.size()) {
+            return false;
+        }
+        uint64_t expected = sizeof(Header) + uint64_t(header.constantCount) * sizeof(Value)
+                          + uint64_t(header.codeCount) * sizeof(Instruction) + uint64_t(header.loopCount) * sizeof(LoopInfo)
+                          + uint64_t(header.arrayOpCount) * sizeof(ArrayOpInfo) + uint64_t(header.compareCount) * sizeof(CompareInfo)
+                          + (uint64_t(header.statementCount) + 1) * sizeof(int) + header.namesBytes;
+        if (expected != image.size() || hashBytes(image.substr(sizeof(Header))) != header.checksum) {
+            return false;
+        }
+
+        const char* next = image.data() + sizeof(Header);
+        auto take = [&next](size_t bytes) {
+            const char* section = next;
+            next += bytes;
+            return section;
+        };
+        bytecode.constants = reinterpret_cast<const Value*>(take(header.constantCount * sizeof(Value)));
+        bytecode.code = reinterpret_cast<const Instruction*>(take(header.codeCount * sizeof(Instruction)));
+        bytecode.loops = reinterpret_cast<const LoopInfo*>(take(header.loopCount * sizeof(LoopInfo)));
+        bytecode.arrayOps = reinterpret_cast<const ArrayOpInfo*>(take(header.arrayOpCount * sizeof(ArrayOpInfo)));
+        bytecode.compares = reinterpret_cast<const CompareInfo*>(take(header.compareCount * sizeof(CompareInfo)));
+        bytecode.statementStarts = reinterpret_cast<const int*>(take((header.statementCount + 1) * sizeof(int)));
+        bytecode.statementCount = header.statementCount;
+        bytecode.maxStack = header.maxStack;
+        if (header.codeCount == 0 || bytecode.code[header.codeCount - 1].op != OP_HALT) return false;
+        const int* starts = bytecode.statementStarts;
+        if (starts[header.statementCount] >= static_cast<int>(header.codeCount)
+            || !std::is_sorted(starts, starts + header.statementCount + 1)) {
+            return false;
+        }
+
+        std::string_view names(take(header.namesBytes), header.namesBytes);
+        symbols = SymbolTable();
+        for (uint32_t i = 0; i < header.variableCount + header.arrayCount; i++) {
+            size_t end = names.find('\0');
+            if (end == std::string_view::npos) return false;
+            std::string_view name = names.substr(0, end);
+            if (i >= header.variableCount) {
+                symbols.declareArray(name);
+            } else if (name.empty()) {
+                symbols.temporary();
+            } else {
+                symbols.resolve(name);
+            }
+            names.remove_prefix(end + 1);
+        }
+        snapshot = {options.snapshotPath, programFingerprint(symbols, header.statementCount), header.statementCount};
+        return true;
+    }
+
+    Frame newFrame() const {
+        Frame frame(symbols.size(), 0);
+        frame.arrays.resize(symbols.arrayCount());
+        return frame;
+    }
+
+    void run(Frame& frame, OutputSink& output, InputSource& input) const {
+        runBytecode(bytecode, frame, symbols, output, input, snapshot);
+    }
+
+    const SymbolTable& symbolTable() const { return symbols; }
+
+private:
+    // Bump VERSION whenever the opcodes, the tokens or these records change.
+    static constexpr char MAGIC[8] = {'B', 'A', 'S', 'I', 'C', 'I', 'M', 'G'};
+    static const uint32_t VERSION = 4;
+    static const uint32_t OPTIMIZED = 1;
+    static const uint32_t FUSED = 2;
+
+    static uint32_t imageFlags(const ProgramOptions& options) {
+        return (options.optimize ? OPTIMIZED : 0) | (options.fuse ? FUSED : 0);
+    }
+
+    // Followed by the constants, code, loops, array operations, compares,
+    // statement starts and names, in that order and without gaps. The header itself has
+    // no padding. Every record before the statement starts is a multiple of 8
+    // bytes, so each section stays aligned in a mapping.
+    struct Header {
+        char magic[8];
+        uint32_t version;
+        uint32_t flags;
+        uint64_t sourceHash;
+        uint64_t checksum;   // Of everything after the header
+        uint64_t size;       // Of the whole image
+        uint32_t constantCount;
+        uint32_t codeCount;
+        uint32_t loopCount;
+        uint32_t arrayOpCount;
+        uint32_t variableCount;
+        uint32_t arrayCount;
+        uint32_t namesBytes;
+        uint32_t maxStack;
+        uint32_t compareCount;
+        uint32_t statementCount;
+    };
+    static_assert(sizeof(Header) == 80 && sizeof(Value) % 8 == 0 && sizeof(Instruction) % 8 == 0
+                  && sizeof(LoopInfo) % 8 == 0 && sizeof(ArrayOpInfo) % 8 == 0 && sizeof(CompareInfo) % 8 == 0, "image sections must stay aligned");
+
+    // Appends the record's listed fields at their offsets in zeroed space, so
+    // padding is zero and the same program always gives the same image.
+    template <typename T, typename... Fields>
+    static void append(std::string& out, const T& record, Fields T::*... fields) {
+        size_t start = out.size();
+        out.resize(start + sizeof(T), '\0');
+        auto copy = [&](const auto& field) {
+            size_t offset = reinterpret_cast<const char*>(&field) - reinterpret_cast<const char*>(&record);
+            std::memcpy(&out[start + offset], &field, sizeof(field));
+        };
+        (copy(record.*fields), ...);
+    }
+
+    MappedFile file;
+    BytecodeView bytecode{};
+    SymbolTable symbols;
+    SnapshotFile snapshot;
+};
+
+const char* const IMAGE_SUFFIX = ".img";
+
+// Loads a Program from wherever main got the source (stdin lines or a file).
+using ProgramLoader = std::function<bool(Program&, const ProgramOptions&)>;
+
+// What -O did to a loaded program.
+void reportOptimizer(std::ostream& out, const Program& program) {
+    out << "Optimizer removed " << program.optimizedNodes() << " nodes (" << program.reusedValues()
+        << " values reused, " << program.deadStores() << " dead stores)\n";
+}
+
+// Times the front end (tokenize + parse) against execution of an already
+// loaded program, averaged over the given number of runs.
+void benchmark(const ProgramLoader& load, int runs, const ProgramOptions& options) {
+    using Clock = std::chrono::steady_clock;
+    Program program;
+
+    auto start = Clock::now();
+    for (int i = 0; i < runs; i++) {
+        load(program, options);
+    }
+    auto frontEnd = Clock::now() - start;
+    if (!program.errorList().empty()) {
+        std::cout << "Program has errors; nothing to benchmark.\n";
+        return;
+    }
+
+    OutputSink null = OutputSink::discard();
+    auto timeEngine = [&](Engine engine) {
+        auto start = Clock::now();
+        for (int i = 0; i < runs; i++) {
+            Frame frame = program.newFrame();
+            InputSource noInput{std::string_view()};
+            program.run(frame, engine, null, noInput);
+        }
+        return Clock::now() - start;
+    };
+    auto execution = timeEngine(TREE_WALKER);
+    auto vmExecution = timeEngine(BYTECODE_VM);
+    auto jitExecution = timeEngine(NATIVE_JIT);
+
+    auto perRun = [runs](Clock::duration d) {
+        return std::chrono::duration<double, std::micro>(d).count() / runs;
+    };
+    std::cout << "Statements: " << program.size() << ", runs: " << runs << "\n";
+    if (options.optimize) {
+        reportOptimizer(std::cout, program);
+    }
+    std::cout << "Front end: " << perRun(frontEnd) << " us/run\n";
+    std::cout << "Execution (tree-walker): " << perRun(execution) << " us/run\n";
+    std::cout << "Execution (bytecode VM): " << perRun(vmExecution) << " us/run\n";
+    std::cout << "Execution (native JIT" << (BASIC_JIT ? "" : ", unavailable") << "): "
+              << perRun(jitExecution) << " us/run\n";
+}
+
+// Builds a synthetic, loadable program of roughly the given size for the
+// lexer and loader benchmarks.
+std::string generateSource(size_t bytes) {
+    std::string source;
+    source.reserve(bytes + 64);
+    for (unsigned i = 0; source.size() < bytes; i++) {
+        std::string name = "value" + std::to_string(i % 97);
+        source += name + " = (" + std::to_string(i * 7919u % 100000) + " + counter" + std::to_string(i % 13)
+                + ") * " + name + " % 1000\n";
+        source += "    IF (" + name + " - 42) PRINT " + name + " ELSE PRINT 0\n";
+    }
+    return source;
+}
+
+// Measures startup for a large program file: mapping it plus loading it.
+bool benchmarkLoad(size_t megabytes) {
+    using Clock = std::chrono::steady_clock;
+    const std::string path = "bench_load.bas";
+    {
+        std::ofstream file(path, std::ios::binary);
+        file << generateSource(megabytes << 20);
+        if (!file) {
+            std::cout << "Cannot write " << path << "!\n";
+            return false;
+        }
+    }
+
+    auto start = Clock::now();
+    MappedFile file;
+    bool ok = file.open(path);
+    auto mapped = Clock::now();
+    Program program;
+    ok = ok && program.load(file.data());
+    auto loaded = Clock::now();
+    std::remove(path.c_str());
+
+    auto ms = [](Clock::duration d) { return std::chrono::duration<double, std::milli>(d).count(); };
+    std::cout << "Source: " << file.data().size() << " bytes, " << program.size() << " statements"
+              << (ok ? "" : " (LOAD FAILED)") << "\n";
+    std::cout << "Map: " << ms(mapped - start) << " ms\n";
+    std::cout << "Load: " << ms(loaded - mapped) << " ms ("
+              << (file.data().size() / 1e6) / std::chrono::duration<double>(loaded - mapped).count() << " MB/s)\n";
+    return ok;
+}
+
+// Startup for a large program file from source (map, tokenize, parse and
+// compile to bytecode) against startup from its image (map the source to
+// check its hash, then map and verify the image).
+bool benchmarkImage(size_t megabytes) {
+    using Clock = std::chrono::steady_clock;
+    const std::string path = "bench_image.bas";
+    const std::string imagePath = path + IMAGE_SUFFIX;
+    {
+        std::ofstream file(path, std::ios::binary);
+        file << generateSource(megabytes << 20);
+        if (!file) {
+            std::cout << "Cannot write " << path << "!\n";
+            return false;
+        }
+    }
+
+    auto start = Clock::now();
+    MappedFile source;
+    Program program;
+    bool ok = source.open(path) && program.load(source.data());
+    auto loaded = Clock::now();
+    ok = ok && ProgramImage::write(imagePath, program, hashBytes(source.data()), ProgramOptions());
+    auto written = Clock::now();
+    source.close();
+
+    auto reopen = Clock::now();
+    MappedFile again;
+    ProgramImage image;
+    ok = ok && again.open(path) && image.open(imagePath, hashBytes(again.data()), ProgramOptions());
+    auto opened = Clock::now();
+    std::ifstream imageFile(imagePath, std::ios::binary | std::ios::ate);
+    auto imageBytes = static_cast<long long>(imageFile.tellg());
+    std::remove(path.c_str());
+    std::remove(imagePath.c_str());
+
+    auto ms = [](Clock::duration d) { return std::chrono::duration<double, std::milli>(d).count(); };
+    std::cout << "Source: " << (megabytes << 20) << " bytes, " << program.size() << " statements"
+              << (ok ? "" : " (FAILED)") << "\n";
+    std::cout << "Image: " << imageBytes << " bytes, " << program.compiled().code.size() << " instructions\n";
+    std::cout << "Load from source: " << ms(loaded - start) << " ms\n";
+    std::cout << "Write image: " << ms(written - loaded) << " ms\n";
+    std::cout << "Open image: " << ms(opened - reopen) << " ms (" << ms(loaded - start) / ms(opened - reopen)
+              << "x faster)\n";
+    return ok;
+}
+
+// Counter-heavy loops, one per fused statement shape, each with ten copies of
+// the statement in its body, run plain and fused on the tree-walker and the
+// VM. Reports the time per statement, loop overhead included.
+bool benchmarkFusion(size_t iterations) {
+    using Clock = std::chrono::steady_clock;
+    struct Shape {
+        const char* name;
+        const char* statement;
+    };
+    const Shape shapes[] = {
+        {"x = x + 1", "X = X + 1"},
+        {"x = x + y", "X = X + Y"},
+        {"PRINT x", "PRINT X"},
+        {"IF (x - k)", "IF (X - 0) END"},
+    };
+    std::cout << "Iterations: " << iterations << ", 10 statements each\n";
+    bool ok = true;
+    for (const Shape& shape : shapes) {
+        std::string source = "10 Y = 3\n20 FOR I = 1 TO " + std::to_string(iterations) + "\n";
+        for (int copy = 0; copy < 10; copy++) {
+            source += std::to_string(30 + copy) + " " + shape.statement + "\n";
+        }
+        source += "40 NEXT I\n";
+
+        for (Engine engine : {TREE_WALKER, BYTECODE_VM}) {
+            double nanos[2];
+            Frame frames[2];
+            for (int fused = 0; fused < 2; fused++) {
+                ProgramOptions options;
+                options.fuse = fused;
+                Program program;
+                ok = ok && program.load(source, options);
+                frames[fused] = program.newFrame();
+                InputSource noInput{std::string_view()};
+                OutputSink output = OutputSink::discard();
+                auto start = Clock::now();
+                program.run(frames[fused], engine, output, noInput);
+                nanos[fused] = std::chrono::duration<double, std::nano>(Clock::now() - start).count() / (iterations * 10.0);
+            }
+            for (size_t slot = 0; slot < frames[0].size(); slot++) {
+                ok = ok && frames[0][slot].identical(frames[1][slot]);
+            }
+            std::cout << shape.name << " (" << (engine == TREE_WALKER ? "tree-walker" : "bytecode VM") << "): "
+                      << nanos[0] << " ns plain, " << nanos[1] << " ns fused (" << nanos[0] / nanos[1] << "x)\n";
+        }
+    }
+    if (!ok) std::cout << "Fused and plain runs DIFFER\n";
+    return ok;
+}
+
+// Parses statements of the given number of terms (a flat sum, all five
+// arithmetic operators, and comparisons joined by AND and OR) and reports
+// the parser's throughput on the tokens, tokenized beforehand. The
+// statements are deep enough to be flattened, which is included.
+bool benchmarkParse(size_t terms) {
+    using Clock = std::chrono::steady_clock;
+    struct Shape {
+        const char* name;
+        std::vector<const char*> pieces;  // Alternating operand, operator, ...
+    };
+    const Shape shapes[] = {
+        {"a + b + ...", {"A", "+", "1", "+", "B", "+"}},
+        {"a * b + c / d % e - ...", {"A", "*", "3", "+", "B", "/", "2", "%", "C", "-"}},
+        {"a < b AND c <> d OR ...", {"A", "<", "3", "AND", "B", "<>", "C", "OR", "A", ">=", "2", "AND", "B", "==", "1", "OR"}},
+    };
+    bool ok = true;
+    for (const Shape& shape : shapes) {
+        std::string source = "X =";
+        for (size_t i = 0; i < 2 * terms - 1; i++) {
+            source += ' ';
+            source += shape.pieces[i % shape.pieces.size()];
+        }
+        std::vector<Token> tokens = Tokenizer(source).tokenize();
+        SymbolTable symbols;
+        double best = 1e30;
+        for (int pass = 0; pass < 5; pass++) {
+            auto start = Clock::now();
+            std::unique_ptr<ASTNode> statement = Parser(tokens, symbols).parse();
+            best = std::min(best, std::chrono::duration<double, std::milli>(Clock::now() - start).count());
+            ok = ok && statement != nullptr;
+        }
+        std::cout << shape.name << ", " << terms << " terms: " << best << " ms, "
+                  << tokens.size() / best / 1000 << "M tokens/s\n";
+    }
+    if (!ok) std::cout << "Syntax error in a benchmark statement\n";
+    return ok;
+}
+
+// Evaluates the same left-leaning chains as recursive trees and flattened,
+// at depths recursion survives, then loads and runs a chain of the given
+// number of terms, which only the flattened form can evaluate, on the
+// tree-walker and the VM, and the same terms nested in parentheses. Reports
+// the time per node.
+bool benchmarkDeep(size_t terms) {
+    using Clock = std::chrono::steady_clock;
+    const TokenType ops[] = {PLUS, MULTIPLY, MINUS, PLUS, DIVIDE};
+    // a op0 (b * 3) op1 c op2 4 ..., the parenthesized terms one level deep
+    auto chain = [&](size_t length) {
+        std::unique_ptr<ASTNode> tree = std::make_unique<VariableNode>(0);
+        for (size_t i = 1; i < length; i++) {
+            std::unique_ptr<ASTNode> operand;
+            switch (i % 3) {
+                case 0: operand = std::make_unique<NumberNode>(int64_t(i % 7 + 1)); break;
+                case 1: operand = std::make_unique<VariableNode>(1); break;
+                default:
+                    operand = makeBinaryOp(std::make_unique<VariableNode>(2), std::make_unique<NumberNode>(int64_t(3)), MULTIPLY);
+                    break;
+            }
+            tree = makeBinaryOp(std::move(tree), std::move(operand), ops[i % 5]);
+        }
+        return tree;
+    };
+    Frame frame(3, 0);
+    frame[0] = int64_t(5);
+    frame[1] = int64_t(2);
+    frame[2] = int64_t(1);
+    bool ok = true;
+    for (size_t length : {size_t(100), size_t(1000), size_t(10000)}) {
+        std::unique_ptr<ASTNode> recursive = chain(length);
+        std::unique_ptr<ASTNode> flat = flattenExpression(chain(length));
+        size_t nodes = countNodes(*recursive);
+        size_t repeats = 2000000 / nodes + 1;
+        auto nsPerNode = [&](ASTNode& expression, Value& result) {
+            double best = 1e30;
+            for (int pass = 0; pass < 5; pass++) {
+                auto start = Clock::now();
+                for (size_t i = 0; i < repeats; i++) result = expression.evaluate(frame);
+                best = std::min(best, std::chrono::duration<double, std::nano>(Clock::now() - start).count());
+            }
+            return best / (repeats * nodes);
+        };
+        Value recursiveResult, flatResult;
+        double recursiveNs = nsPerNode(*recursive, recursiveResult);
+        double flatNs = nsPerNode(*flat, flatResult);
+        ok = ok && recursiveResult.identical(flatResult);
+        std::cout << "Depth " << length << ": recursive " << recursiveNs << " ns/node, flattened " << flatNs
+                  << " ns/node (" << recursiveNs / flatNs << "x)\n";
+    }
+
+    // The chain as a line, and the same number of terms nested to the right,
+    // a op0 (b op1 (c op2 (...))), so the parser has to nest that deep too.
+    std::string chainSource = "A = 5\nB = 2\nC = 1\nX = A";
+    std::string nestedSource = "A = 5\nB = 2\nC = 1\nX = A";
+    const char* operands[] = {" 4", " B", " (C * 3)"};
+    const char* nestedOperands[] = {" 4", " B", " C"};
+    const char* symbols[] = {" +", " *", " -", " +", " /"};
+    const char* nestedSymbols[] = {" +", " *", " -", " +", " -"};
+    for (size_t i = 1; i < terms; i++) {
+        chainSource += symbols[i % 5];
+        chainSource += operands[i % 3];
+        nestedSource += nestedSymbols[i % 5];
+        nestedSource += " (";
+        nestedSource += nestedOperands[i % 3];
+    }
+    chainSource += "\n";
+    nestedSource += std::string(terms - 1, ')') + "\n";
+    Value results[2][2];
+    for (int nested = 0; nested < 2; nested++) {
+        for (Engine engine : {TREE_WALKER, BYTECODE_VM}) {
+            Program program;
+            auto start = Clock::now();
+            ok = ok && program.load(nested ? nestedSource : chainSource, ProgramOptions());
+            auto loaded = Clock::now();
+            Frame run = program.newFrame();
+            InputSource noInput{std::string_view()};
+            OutputSink output = OutputSink::discard();
+            program.run(run, engine, output, noInput);
+            auto ran = Clock::now();
+            results[nested][engine == BYTECODE_VM] = run[3];
+            auto ms = [](Clock::duration d) { return std::chrono::duration<double, std::milli>(d).count(); };
+            std::cout << terms << (nested ? " nested terms (" : " terms (")
+                      << (engine == TREE_WALKER ? "tree-walker" : "bytecode VM") << "): load " << ms(loaded - start)
+                      << " ms, run " << ms(ran - loaded) << " ms\n";
+        }
+        ok = ok && results[nested][0].identical(results[nested][1]);
+    }
+    if (!ok) std::cout << "Recursive and flattened results DIFFER\n";
+    return ok;
+}
+
+// SAVE and LOAD of frames holding 1/16 MB up to the given size of state
+// (mostly one array, the rest variables), to show both scale with the state
+// and nothing else.
+bool benchmarkSnapshot(size_t megabytes) {
+    using Clock = std::chrono::steady_clock;
+    SnapshotFile file{"bench_snapshot.snap", 0, 1};
+    bool ok = true;
+    for (size_t bytes = size_t(64) << 10; bytes <= megabytes << 20; bytes *= 4) {
+        Frame frame(bytes / 16 / sizeof(Value), 0);
+        for (size_t slot = 0; slot < frame.size(); slot++) frame[slot] = int64_t(slot);
+        frame.arrays.resize(2);
+        frame.arrays[0].resize((bytes - bytes / 16) / sizeof(int));
+        for (size_t i = 0; i < frame.arrays[0].size(); i++) frame.arrays[0][i] = static_cast<int>(i);
+
+        auto start = Clock::now();
+        ok = ok && saveSnapshot(file, frame, 1, {}) == nullptr;
+        auto saved = Clock::now();
+        Frame resumed(frame.size(), 0);
+        resumed.arrays.resize(2);
+        size_t resume = 0;
+        std::vector<size_t> returnStack;
+        ok = ok && loadSnapshot(file, resumed, resume, returnStack) == nullptr;
+        auto loaded = Clock::now();
+        ok = ok && resume == 1 && resumed.arrays[0] == frame.arrays[0];
+
+        auto ms = [](Clock::duration d) { return std::chrono::duration<double, std::milli>(d).count(); };
+        std::cout << "State " << (bytes >> 10) << " KB: SAVE " << ms(saved - start) << " ms, LOAD "
+                  << ms(loaded - saved) << " ms (" << bytes / 1048576.0 / std::max(ms(loaded - saved) / 1000, 1e-9)
+                  << " MB/s)\n";
+    }
+    std::remove(file.path.c_str());
+    if (!ok) std::cout << "Snapshot round trip FAILED\n";
+    return ok;
+}
+
+// Runs a large generated program after a full load and again while it loads
+// (runWhileLoading), reporting when the first output reached the pipe it is
+// written to and when the run finished. Output goes out in whole buffers, as
+// it does to any pipe or file.
+bool benchmarkPipeline(size_t megabytes) {
+#ifdef _WIN32
+    (void)megabytes;
+    std::cout << "The pipeline benchmark needs POSIX pipes.\n";
+    return true;
+#else
+    using Clock = std::chrono::steady_clock;
+    std::string source = generateSource(megabytes << 20);
+    std::cout << "Source: " << source.size() << " bytes, " << std::thread::hardware_concurrency() << " hardware threads\n";
+
+    using Runner = std::function<bool(Program&, Frame&, OutputSink&, InputSource&)>;
+    auto measure = [&](const char* name, const Runner& runProgram) {
+        int fds[2];
+        if (pipe(fds) != 0) return false;
+        Clock::time_point firstOutput;
+        size_t bytes = 0;
+        std::thread reader([&] {
+            char buffer[64 * 1024];
+            ssize_t n;
+            while ((n = read(fds[0], buffer, sizeof buffer)) > 0) {
+                if (bytes == 0) firstOutput = Clock::now();
+                bytes += n;
+            }
+        });
+
+        auto start = Clock::now();
+        bool ok;
+        {
+            Program program;
+            Frame frame;
+            InputSource noInput{std::string_view()};
+            OutputSink output(fds[1], FLUSH_AT_EXIT);
+            ok = runProgram(program, frame, output, noInput);
+        }
+        auto finished = Clock::now();
+        close(fds[1]);
+        reader.join();
+        close(fds[0]);
+
+        auto ms = [](Clock::duration d) { return std::chrono::duration<double, std::milli>(d).count(); };
+        std::cout << name << ": first output " << (bytes ? ms(firstOutput - start) : 0.0) << " ms, total "
+                  << ms(finished - start) << " ms, " << bytes << " bytes" << (ok ? "" : " (RUN FAILED)") << "\n";
+        return ok;
+    };
+
+    bool ok = measure("load, then run", [&](Program& program, Frame& frame, OutputSink& output, InputSource& input) {
+        if (!program.load(source)) return false;
+        frame = program.newFrame();
+        program.run(frame, TREE_WALKER, output, input);
+        return true;
+    });
+    ok = measure("run while loading", [&](Program& program, Frame& frame, OutputSink& output, InputSource& input) {
+        return program.runWhileLoading(std::string_view(source), ProgramOptions(), frame, TREE_WALKER, output, input);
+    }) && ok;
+    return ok;
+#endif
+}
+
+bool sameTokens(const std::vector<Token>& a, const std::vector<Token>& b) {
+    if (a.size() != b.size()) return false;
+    for (size_t i = 0; i < a.size(); i++) {
+        if (a[i].type != b[i].type || a[i].text.data() != b[i].text.data()
+            || a[i].text.size() != b[i].text.size() || !a[i].number.identical(b[i].number)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Measures tokenizer throughput for each scanning strategy on a generated
+// source and checks that they all produce the byte-loop's token stream.
+bool benchmarkLexer(size_t megabytes) {
+    using Clock = std::chrono::steady_clock;
+    std::string source = generateSource(megabytes << 20);
+    std::vector<Token> reference = Tokenizer(source, nullptr).tokenize();
+
+    struct Strategy {
+        const char* name;
+        ClassifyFn classify;
+    };
+    std::vector<Strategy> strategies = {{"byte loop", nullptr}, {"scalar blocks", &classifyScalar}};
+#if BASIC_X86_SIMD
+    if (__builtin_cpu_supports("sse2")) strategies.push_back({"SSE2", &classifySse2});
+    if (__builtin_cpu_supports("avx2")) strategies.push_back({"AVX2", &classifyAvx2});
+#endif
+
+    std::cout << "Source: " << source.size() << " bytes, " << reference.size() << " tokens\n";
+    bool allMatch = true;
+    for (const Strategy& strategy : strategies) {
+        std::vector<Token> tokens;
+        double seconds = 1e30;
+        for (int round = 0; round < 3; round++) { // Best of three
+            auto start = Clock::now();
+            tokens = Tokenizer(source, strategy.classify).tokenize();
+            seconds = std::min(seconds, std::chrono::duration<double>(Clock::now() - start).count());
+        }
+        bool match = sameTokens(tokens, reference);
+        allMatch = allMatch && match;
+        std::cout << strategy.name << ": " << (source.size() / 1e6) / seconds << " MB/s"
+                  << (match ? "" : " (TOKEN STREAM MISMATCH)") << "\n";
+    }
+    return allMatch;
+}
+
+// Measures INPUT parsing throughput in records per second: a buffer parsed in
+// place (as a --data file is), the same text through the stream path used for
+// stdin, and plain std::istream >> int for comparison.
+void benchmarkInput(size_t records) {
+    using Clock = std::chrono::steady_clock;
+    std::string data;
+    data.reserve(records * 8);
+    for (size_t i = 0; i < records; i++) {
+        data += std::to_string(static_cast<int>(i * 2654435761u % 2000001) - 1000000);
+        data += (i % 8 == 7) ? '\n' : ' ';
+    }
+
+    auto report = [&](const char* name, Clock::duration elapsed, long long checksum) {
+        double seconds = std::chrono::duration<double>(elapsed).count();
+        std::cout << name << ": " << records / seconds << " records/s (checksum " << checksum << ")\n";
+    };
+
+    auto start = Clock::now();
+    InputSource buffer{std::string_view(data)};
+    long long sum = 0;
+    for (size_t i = 0; i < records; i++) sum += buffer.readValue().i;
+    report("buffer (from_chars)", Clock::now() - start, sum);
+
+    std::istringstream text(data);
+    start = Clock::now();
+    InputSource stream(text, false);
+    sum = 0;
+    for (size_t i = 0; i < records; i++) sum += stream.readValue().i;
+    report("stream (from_chars)", Clock::now() - start, sum);
+
+    std::istringstream baseline(data);
+    start = Clock::now();
+    sum = 0;
+    for (size_t i = 0; i < records; i++) {
+        int value = 0;
+        baseline >> value;
+        sum += value;
+    }
+    report("std::istream >> int", Clock::now() - start, sum);
+}
+
+// How this interpreter writes the --bench-suite workloads (bench_suite.h).
+const SuiteDialect MODIFY_DIALECT = {true, "IF (", ") "};
+
+// Front end and evaluator cost per unit of work for each workload, as one
+// JSON object: ns per token for the tokenizer, ns per AST node for the parser
+// and ns per executed statement for each engine. Each figure is the best of
+// several passes.
+void benchmarkSuite(size_t lines) {
+    const int passes = 5;
+
+    std::cout << "{\"variant\": \"modify\", \"lines\": " << lines << ", \"workloads\": [";
+    for (int w = 0; w < WORKLOAD_COUNT; w++) {
+        Workload workload = static_cast<Workload>(w);
+        std::vector<std::string> sourceLines = generateWorkload(workload, lines, MODIFY_DIALECT);
+        std::string source;
+        for (const std::string& line : sourceLines) source += line + '\n';
+
+        std::vector<std::vector<Token>> tokens(sourceLines.size());
+        double tokenizeNs = bestOf(passes, [&] {
+            for (size_t i = 0; i < sourceLines.size(); i++) tokens[i] = Tokenizer(sourceLines[i]).tokenize();
+        });
+        size_t tokenCount = 0;
+        for (const auto& line : tokens) tokenCount += line.size();
+
+        std::vector<std::unique_ptr<ASTNode>> trees(tokens.size());
+        double parseNs = bestOf(passes, [&] {
+            SymbolTable symbols;
+            for (size_t i = 0; i < tokens.size(); i++) trees[i] = Parser(tokens[i], symbols).parse();
+        });
+        size_t nodeCount = 0;
+        for (const auto& tree : trees) nodeCount += tree ? countNodes(*tree) : 0;
+
+        Program program;
+        program.load(std::string_view(source));
+        OutputSink null = OutputSink::discard();
+        auto evalNs = [&](Engine engine) {
+            Frame frame = program.newFrame();
+            InputSource noInput{std::string_view()};
+            // Enough passes for the JIT to compile every hot statement first.
+            return bestOf(2 * JIT_HOT_THRESHOLD, [&] { program.run(frame, engine, null, noInput); }) / program.size();
+        };
+
+        std::cout << (w ? ",\n  " : "\n  ") << "{\"name\": \"" << workloadName(workload)
+                  << "\", \"statements\": " << program.size() << ", \"tokens\": " << tokenCount
+                  << ", \"nodes\": " << nodeCount
+                  << ", \"ns_per_token\": " << tokenizeNs / tokenCount
+                  << ", \"ns_per_node_parse\": " << parseNs / nodeCount
+                  << ", \"ns_per_statement_eval\": " << evalNs(TREE_WALKER)
+                  << ", \"ns_per_statement_eval_vm\": " << evalNs(BYTECODE_VM)
+                  << ", \"ns_per_statement_eval_jit\": " << evalNs(NATIVE_JIT) << "}";
+    }
+    std::cout << "\n]}\n";
+}
+
+// Rebuilds every operator in a statement as a plain BinaryOpNode, which
+// switches on its operator at every evaluation, for --bench-ops.
+std::unique_ptr<ASTNode> withGenericOperators(std::unique_ptr<ASTNode> node) {
+    switch (node->kind) {
+        case BINARY_OP_NODE: {
+            auto& binary = static_cast<BinaryOpNode&>(*node);
+            return std::make_unique<BinaryOpNode>(withGenericOperators(std::move(binary.left)),
+                                                  withGenericOperators(std::move(binary.right)), binary.op);
+        }
+        case ASSIGNMENT_NODE: {
+            auto& assignment = static_cast<AssignmentNode&>(*node);
+            assignment.expression = withGenericOperators(std::move(assignment.expression));
+            break;
+        }
+        case IF_ELSE_NODE: {
+            auto& ifElse = static_cast<IfElseNode&>(*node);
+            ifElse.condition = withGenericOperators(std::move(ifElse.condition));
+            ifElse.thenBranch = withGenericOperators(std::move(ifElse.thenBranch));
+            if (ifElse.elseBranch) ifElse.elseBranch = withGenericOperators(std::move(ifElse.elseBranch));
+            break;
+        }
+        default:
+            break;
+    }
+    return node;
+}
+
+// Evaluates the expression-heavy --bench-suite workloads with the operator
+// nodes the parser builds and again with generic BinaryOpNodes, and reports
+// the cost per node of each.
+void benchmarkOperators(size_t lines) {
+    using Clock = std::chrono::steady_clock;
+    for (Workload workload : {LONG_EXPRESSIONS, MANY_VARIABLES, DEEP_NESTING, IF_HEAVY}) {
+        std::vector<std::string> source = generateWorkload(workload, lines, MODIFY_DIALECT);
+        SymbolTable symbols;
+        std::vector<std::unique_ptr<ASTNode>> specialized, generic;
+        size_t nodes = 0;
+        std::vector<std::vector<Token>> tokens;
+        for (const std::string& line : source) tokens.push_back(Tokenizer(line).tokenize());
+        for (const auto& line : tokens) {
+            Parser(line, symbols).parse(); // Every name interned first, so both trees get the same kind of heap
+        }
+        for (const auto& line : tokens) {
+            specialized.push_back(Parser(line, symbols).parse());
+            nodes += countNodes(*specialized.back());
+        }
+        for (const auto& line : tokens) {
+            generic.push_back(withGenericOperators(Parser(line, symbols).parse()));
+        }
+
+        Frame frame(symbols.size(), 0);
+        // IF takes its branch here, as Program::execute() would; the branches
+        // the workloads generate are all assignments.
+        auto run = [&](ASTNode* statement) {
+            while (statement && statement->kind == IF_ELSE_NODE) {
+                auto& ifElse = static_cast<IfElseNode&>(*statement);
+                statement = ifElse.condition->evaluate(frame).isTrue() ? ifElse.thenBranch.get() : ifElse.elseBranch.get();
+            }
+            if (statement) statement->evaluate(frame);
+        };
+        auto nsPerNode = [&](std::vector<std::unique_ptr<ASTNode>>& statements) {
+            double best = 1e30;
+            for (int pass = 0; pass < 50; pass++) {
+                auto start = Clock::now();
+                for (auto& statement : statements) run(statement.get());
+                best = std::min(best, std::chrono::duration<double, std::nano>(Clock::now() - start).count());
+            }
+            return best / nodes;
+        };
+        double genericNs = nsPerNode(generic);
+        double specializedNs = nsPerNode(specialized);
+        std::cout << workloadName(workload) << ": BinaryOpNode " << genericNs << " ns/node, operator nodes "
+                  << specializedNs << " ns/node (" << genericNs / specializedNs << "x)\n";
+    }
+}
+
+// Times A = B + C over arrays of the given size: as a whole-array statement
+// against the equivalent FOR loop over elements on each engine, and the
+// vector kernels on their own against the scalar loops, for --bench-arrays.
+void benchmarkArrays(size_t elements) {
+    using Clock = std::chrono::steady_clock;
+    const int passes = 20;
+    std::string setup = "DIM A(" + std::to_string(elements - 1) + ")\nDIM B(" + std::to_string(elements - 1)
+        + ")\nDIM C(" + std::to_string(elements - 1) + ")\nB = 3\nC = 4\n";
+    std::string loop = setup + "FOR R = 1 TO " + std::to_string(passes) + "\nFOR I = 0 TO "
+        + std::to_string(elements - 1) + "\nA(I) = B(I) + C(I)\nNEXT I\nNEXT R\n";
+    std::string whole = setup + "FOR R = 1 TO " + std::to_string(passes) + "\nA = B + C\nNEXT R\n";
+
+    auto nsPerElement = [&](const std::string& source, Engine engine) {
+        Program program;
+        program.load(source);
+        OutputSink output = OutputSink::discard();
+        InputSource input{std::string_view()};
+        Frame frame = program.newFrame();
+        auto start = Clock::now();
+        program.run(frame, engine, output, input);
+        return std::chrono::duration<double, std::nano>(Clock::now() - start).count() / (double(elements) * passes);
+    };
+    for (Engine engine : {TREE_WALKER, BYTECODE_VM}) {
+        double loopNs = nsPerElement(loop, engine);
+        double wholeNs = nsPerElement(whole, engine);
+        std::cout << (engine == TREE_WALKER ? "tree-walker" : "bytecode VM") << ": element loop " << loopNs
+                  << " ns/element, whole-array statement " << wholeNs << " ns/element (" << loopNs / wholeNs << "x)\n";
+    }
+
+    IntArray a(elements), b(elements, 3), c(elements, 4);
+    volatile int sink = 0;
+    auto kernelNs = [&](const ArrayKernels& kernels, int row) {
+        double best = 1e30;
+        for (int pass = 0; pass < passes; pass++) {
+            auto start = Clock::now();
+            if (row < 0) {
+                sink = kernels.sum(b.data(), elements);
+            } else {
+                kernels.apply[row][ARRAY_ARRAY](a.data(), b.data(), c.data(), 0, elements);
+            }
+            best = std::min(best, std::chrono::duration<double, std::nano>(Clock::now() - start).count());
+        }
+        return best / elements;
+    };
+    const ArrayKernels& best = bestArrayKernels();
+    const char* kernelName = &best == &SCALAR_ARRAY_KERNELS ? "scalar" : "AVX2";
+    for (int row : {0, 2, -1}) {
+        double scalarNs = kernelNs(SCALAR_ARRAY_KERNELS, row);
+        double bestNs = kernelNs(best, row);
+        std::cout << (row == 0 ? "add" : row == 2 ? "multiply" : "sum") << " kernel: scalar " << scalarNs
+                  << " ns/element, " << kernelName << " " << bestNs << " ns/element (" << scalarNs / bestNs << "x)\n";
+    }
+}
+
+// Runs the program on both engines against the same input and checks that
+// they print the same thing and finish with the same variable values as the
+// reference: the unoptimized program on the tree-walker.
+bool differentialCheck(Program& reference, Program& program, const std::string& input) {
+    auto capture = [&](Program& target, Engine engine, Frame& frame) {
+        InputSource in(input);
+        std::string out;
+        {
+            OutputSink output(out);
+            frame = target.newFrame();
+            target.run(frame, engine, output, in);
+        }
+        return out;
+    };
+
+    Frame expectedFrame;
+    std::string expected = capture(reference, TREE_WALKER, expectedFrame);
+
+    struct Candidate {
+        const char* name;
+        Engine engine;
+    };
+    for (const Candidate& candidate : {Candidate{"tree-walker", TREE_WALKER}, Candidate{"bytecode VM", BYTECODE_VM},
+                                          Candidate{"native JIT", NATIVE_JIT}}) {
+        Frame frame;
+        std::string output = capture(program, candidate.engine, frame);
+        if (output != expected) {
+            std::cout << "Output differs on " << candidate.name << "!\n--- reference ---\n" << expected
+                      << "--- " << candidate.name << " ---\n" << output;
+            return false;
+        }
+        for (size_t slot = 0; slot < expectedFrame.size(); slot++) {
+            if (!frame[slot].identical(expectedFrame[slot])) {
+                std::cout << "Variable " << program.symbolTable().name(static_cast<int>(slot)) << " differs on "
+                          << candidate.name << ": " << frame[slot] << " vs " << expectedFrame[slot] << "\n";
+                return false;
+            }
+        }
+        for (size_t array = 0; array < expectedFrame.arrays.size(); array++) {
+            if (frame.arrays[array] != expectedFrame.arrays[array]) {
+                std::cout << "Array " << program.symbolTable().arrayName(static_cast<int>(array)) << " differs on "
+                          << candidate.name << "\n";
+                return false;
+            }
+        }
+    }
+    std::cout << "Engines agree.\n";
+    return true;
+}
+
+// A fixed set of threads working through jobs 0..count-1. The jobs are dealt
+// out round-robin to one deque per thread; a thread takes its own work from
+// the front and, once that runs dry, steals from the back of another's, so a
+// few slow jobs do not leave the other threads idle.
+class WorkStealingPool {
+public:
+    explicit WorkStealingPool(unsigned threads) : queues(std::max(1u, threads)) {}
+
+    // Runs every job and returns once all of them have finished.
+    void run(size_t count, const std::function<void(size_t)>& job) {
+        for (size_t i = 0; i < count; i++) {
+            queues[i % queues.size()].jobs.push_back(i);
+        }
+        std::vector<std::thread> threads;
+        for (size_t self = 0; self < queues.size(); self++) {
+            threads.emplace_back([this, self, &job] {
+                size_t next;
+                while (take(self, next)) job(next);
+            });
+        }
+        for (std::thread& thread : threads) {
+            thread.join();
+        }
+    }
+
+    size_t threadCount() const { return queues.size(); }
+    size_t steals() const { return stolen.load(); }
+
+private:
+    struct Queue {
+        std::mutex lock;
+        std::deque<size_t> jobs;
+    };
+
+    bool take(size_t self, size_t& job) {
+        {
+            std::lock_guard<std::mutex> guard(queues[self].lock);
+            if (!queues[self].jobs.empty()) {
+                job = queues[self].jobs.front();
+                queues[self].jobs.pop_front();
+                return true;
+            }
+        }
+        // Nothing is ever added once the pool runs, so empty everywhere means done.
+        for (size_t k = 1; k < queues.size(); k++) {
+            Queue& victim = queues[(self + k) % queues.size()];
+            std::lock_guard<std::mutex> guard(victim.lock);
+            if (!victim.jobs.empty()) {
+                job = victim.jobs.back();
+                victim.jobs.pop_back();
+                stolen++;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    std::vector<Queue> queues;
+    std::atomic<size_t> stolen{0};
+};
+
+// One program of a batch and what running it produced.
+struct BatchJob {
+    std::string programPath;
+    std::string dataPath;    // INPUT data; none means every INPUT reads 0
+    bool ok = false;
+    std::string output;      // PRINT output, then any errors
+    double loadMicros = 0;   // Mapping and loading the program
+    double runMicros = 0;
+};
+
+// The programs named by a manifest (one "program [data]" per line, relative
+// to the manifest; blank lines and lines starting with # are skipped) or
+// every .bas file in a directory, with a same-named .in file as its data.
+bool collectBatch(const std::string& path, std::vector<BatchJob>& jobs) {
+    namespace fs = std::filesystem;
+    std::error_code error;
+    if (fs::is_directory(path, error)) {
+        for (const fs::directory_entry& entry : fs::directory_iterator(path, error)) {
+            if (entry.path().extension() != ".bas") continue;
+            BatchJob job;
+            job.programPath = entry.path().string();
+            fs::path data = fs::path(entry.path()).replace_extension(".in");
+            if (fs::exists(data, error)) job.dataPath = data.string();
+            jobs.push_back(std::move(job));
+        }
+        std::sort(jobs.begin(), jobs.end(),
+                  [](const BatchJob& a, const BatchJob& b) { return a.programPath < b.programPath; });
+        return !error;
+    }
+
+    std::ifstream manifest(path);
+    if (!manifest) return false;
+    fs::path base = fs::path(path).parent_path();
+    std::string line;
+    while (std::getline(manifest, line)) {
+        std::istringstream fields(line);
+        std::string program, data;
+        if (!(fields >> program) || program[0] == '#') continue;
+        fields >> data;
+        BatchJob job;
+        job.programPath = (base / program).string();
+        if (!data.empty()) job.dataPath = (base / data).string();
+        jobs.push_back(std::move(job));
+    }
+    return true;
+}
+
+// Loads and runs one program in complete isolation: its own Program (symbols,
+// JIT code), frame, input and captured output, so any number can run at once.
+void runBatchJob(BatchJob& job, Engine engine, const ProgramOptions& options) {
+    using Clock = std::chrono::steady_clock;
+    auto start = Clock::now();
+    MappedFile file;
+    std::unique_ptr<InputSource> input;
+    if (!file.open(job.programPath)) {
+        job.output = "Cannot read program file " + job.programPath + "!\n";
+        return;
+    }
+    if (job.dataPath.empty()) {
+        input = std::make_unique<InputSource>(std::string_view());
+    } else if (!(input = InputSource::openFile(job.dataPath))) {
+        job.output = "Cannot read data file " + job.dataPath + "!\n";
+        return;
+    }
+    // Each job saves and loads next to its own program.
+    ProgramOptions jobOptions = options;
+    jobOptions.snapshotPath = job.programPath + ".snap";
+    Program program;
+    bool loaded = program.load(file.data(), jobOptions);
+    auto ready = Clock::now();
+    job.loadMicros = std::chrono::duration<double, std::micro>(ready - start).count();
+    if (!loaded) {
+        for (const LoadError& error : program.errorList()) {
+            job.output += error.message + " on line " + std::to_string(error.line) + "!\n";
+        }
+        return;
+    }
+
+    Frame frame = program.newFrame();
+    {
+        OutputSink output(job.output);
+        program.run(frame, engine, output, *input);
+    }
+    job.runMicros = std::chrono::duration<double, std::micro>(Clock::now() - ready).count();
+    job.ok = true;
+}
+
+// Runs every program of a batch on a work-stealing thread pool and reports
+// per-program load and run times. Captured output goes to outputDir as
+// <program>.out when one is given.
+bool runBatch(const std::string& path, unsigned threads, const std::string& outputDir, Engine engine,
+              const ProgramOptions& options) {
+    using Clock = std::chrono::steady_clock;
+    std::vector<BatchJob> jobs;
+    if (!collectBatch(path, jobs)) {
+        std::cout << "Cannot read batch " << path << "!\n";
+        return false;
+    }
+
+    WorkStealingPool pool(threads);
+    auto start = Clock::now();
+    pool.run(jobs.size(), [&](size_t i) { runBatchJob(jobs[i], engine, options); });
+    double wallMicros = std::chrono::duration<double, std::micro>(Clock::now() - start).count();
+
+    size_t failed = 0;
+    double loadTotal = 0, runTotal = 0;
+    for (const BatchJob& job : jobs) {
+        std::string name = std::filesystem::path(job.programPath).filename().string();
+        std::cout << name << ": " << (job.ok ? "ok" : "FAILED") << ", load " << job.loadMicros << " us, run "
+                  << job.runMicros << " us, " << job.output.size() << " bytes of output\n";
+        if (!job.ok) failed++;
+        loadTotal += job.loadMicros;
+        runTotal += job.runMicros;
+        if (!outputDir.empty()) {
+            std::ofstream((std::filesystem::path(outputDir) / (name + ".out")).string(), std::ios::binary) << job.output;
+        }
+    }
+    std::cout << jobs.size() << " programs, " << failed << " failed, " << pool.threadCount() << " threads, "
+              << pool.steals() << " steals\n";
+    if (!jobs.empty()) {
+        std::cout << "Wall time: " << wallMicros << " us (" << wallMicros / jobs.size() << " us/program)\n";
+        std::cout << "Per program: load " << loadTotal / jobs.size() << " us, run " << runTotal / jobs.size() << " us\n";
+    }
+    return failed == 0;
+}
+
+// Prints each syntax or link error found while loading.
+void reportLoadErrors(const Program& program) {
+    for (const LoadError& error : program.errorList()) {
+        std::cout << error.message << " on line " << error.line << "!" << std::endl;
+    }
+}
+
+// --dump: every named variable, then every array's size and first elements.
+void dumpFrame(const SymbolTable& symbols, const Frame& frame) {
+    auto variables = symbols.dump(frame);
+    for (size_t slot = 0; slot < symbols.size(); slot++) {
+        const std::string& name = symbols.name(static_cast<int>(slot));
+        if (name.empty()) continue;
+        std::cout << name << " = " << variables[name] << "\n";
+    }
+    for (size_t array = 0; array < symbols.arrayCount() && array < frame.arrays.size(); array++) {
+        const IntArray& values = frame.arrays[array];
+        std::cout << symbols.arrayName(static_cast<int>(array)) << "(" << values.size() << ") =";
+        for (size_t i = 0; i < values.size() && i < 16; i++) std::cout << " " << values[i];
+        std::cout << (values.size() > 16 ? " ...\n" : "\n");
+    }
+}
+
+// Loads the source and writes its image. Returns false after reporting why not.
+bool compileImage(std::string_view source, const std::string& imagePath, const ProgramOptions& options) {
+    Program program;
+    if (!program.load(source, options)) {
+        reportLoadErrors(program);
+        return false;
+    }
+    if (!ProgramImage::write(imagePath, program, hashBytes(source), options)) {
+        std::cout << "Cannot write image " << imagePath << "!" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+// --image: runs the program from its image on the VM, first rebuilding the
+// image if it is missing or stale. Returns false if it could not be run.
+bool runImage(std::string_view source, const std::string& imagePath, const ProgramOptions& options,
+              InputSource& input, bool dumpVariables) {
+    ProgramImage image;
+    if (!image.open(imagePath, hashBytes(source), options)) {
+        if (!compileImage(source, imagePath, options)) return false;
+        if (!image.open(imagePath, hashBytes(source), options)) {
+            std::cout << "Cannot read image " << imagePath << "!" << std::endl;
+            return false;
+        }
+    }
+    Frame frame = image.newFrame();
+    std::cout.flush();
+    OutputSink output(1);
+    image.run(frame, output, input);
+    output.flush();
+    if (dumpVariables) dumpFrame(image.symbolTable(), frame);
+    return true;
+}
+
+// Reads the optional numeric argument after a flag, if there is one.
+long optionalCount(int argc, char* argv[], int& i, long fallback) {
+    if (i + 1 < argc && isdigit(static_cast<unsigned char>(argv[i + 1][0]))) {
+        long value = std::atol(argv[++i]);
+        return value > 0 ? value : fallback;
+    }
+    return fallback;
+}
+
+int main(int argc, char* argv[]) {
+    // All reading goes through std::cin's own buffer and PRINT output through
+    // OutputSink, so the C stdio sync only costs time.
+    std::ios::sync_with_stdio(false);
+    int benchRuns = 0;
+    bool dumpVariables = false;
+    bool diffEngines = false;
+    bool pipeline = false;
+    bool profile = false;
+    bool compile = false;
+    bool useImage = false;
+    bool optimizerReport = false;
+    std::string foldedPath;
+    std::string batchPath;
+    std::string batchOutput;
+    unsigned threads = std::thread::hardware_concurrency();
+    Engine engine = TREE_WALKER;
+    ProgramOptions options;
+    std::string dataPath;
+    std::string programPath;
+    std::string snapshotPath;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--bench-lex") {
+            return benchmarkLexer(optionalCount(argc, argv, i, 16)) ? 0 : 1;
+        } else if (arg == "--bench-input") {
+            benchmarkInput(optionalCount(argc, argv, i, 10000000));
+            return 0;
+        } else if (arg == "--bench-load") {
+            return benchmarkLoad(optionalCount(argc, argv, i, 100)) ? 0 : 1;
+        } else if (arg == "--bench-image") {
+            return benchmarkImage(optionalCount(argc, argv, i, 16)) ? 0 : 1;
+        } else if (arg == "--bench-snapshot") {
+            return benchmarkSnapshot(optionalCount(argc, argv, i, 64)) ? 0 : 1;
+        } else if (arg == "--bench-fusion") {
+            return benchmarkFusion(optionalCount(argc, argv, i, 1000000)) ? 0 : 1;
+        } else if (arg == "--bench-parse") {
+            return benchmarkParse(optionalCount(argc, argv, i, 1000000)) ? 0 : 1;
+        } else if (arg == "--bench-deep") {
+            return benchmarkDeep(optionalCount(argc, argv, i, 1000000)) ? 0 : 1;
+        } else if (arg == "--bench-pipeline") {
+            return benchmarkPipeline(optionalCount(argc, argv, i, 100)) ? 0 : 1;
+        } else if (arg == "--bench-ops") {
+            benchmarkOperators(optionalCount(argc, argv, i, 2000));
+            return 0;
+        } else if (arg == "--bench-arrays") {
+            benchmarkArrays(optionalCount(argc, argv, i, 1000000));
+            return 0;
+        } else if (arg == "--bench-suite") {
+            benchmarkSuite(optionalCount(argc, argv, i, 2000));
+            return 0;
+        } else if (arg == "--bench") {
+            benchRuns = static_cast<int>(optionalCount(argc, argv, i, 1000));
+        } else if (arg == "--dump") {
+            dumpVariables = true;
+        } else if (arg == "-O") {
+            options.optimize = true;
+        } else if (arg == "--no-fuse") {
+            options.fuse = false;
+        } else if (arg == "--opt-report") {
+            optimizerReport = true;
+        } else if (arg == "--vm") {
+            engine = BYTECODE_VM;
+        } else if (arg == "--jit") {
+            engine = NATIVE_JIT;
+        } else if (arg == "--diff") {
+            diffEngines = true;
+        } else if (arg == "--profile") {
+            profile = true;
+        } else if (arg == "--profile-folded" && i + 1 < argc) {
+            profile = true;
+            foldedPath = argv[++i];
+        } else if (arg == "--pipeline") {
+            pipeline = true;
+        } else if (arg == "--compile") {
+            compile = true;
+        } else if (arg == "--image") {
+            useImage = true;
+        } else if (arg == "--batch" && i + 1 < argc) {
+            batchPath = argv[++i];
+        } else if (arg == "--batch-out" && i + 1 < argc) {
+            batchOutput = argv[++i];
+        } else if (arg == "--threads") {
+            threads = static_cast<unsigned>(optionalCount(argc, argv, i, threads));
+        } else if (arg == "--data" && i + 1 < argc) {
+            dataPath = argv[++i];
+        } else if (arg == "--snapshot" && i + 1 < argc) {
+            snapshotPath = argv[++i];
+        } else if (arg[0] != '-') {
+            programPath = arg;
+        }
+    }
+
+    // SAVE and LOAD use the --snapshot file, or one named after the program.
+    // --diff leaves them out: every engine has to start from the same state.
+    if (snapshotPath.empty()) {
+        snapshotPath = (programPath.empty() ? std::string("basic") : programPath) + ".snap";
+    }
+    if (!diffEngines) {
+        options.snapshotPath = snapshotPath;
+    }
+
+    if (!batchPath.empty()) {
+        return runBatch(batchPath, threads, batchOutput, engine, options) ? 0 : 1;
+    }
+    if ((compile || useImage) && programPath.empty()) {
+        std::cout << "--compile and --image need a program file!" << std::endl;
+        return 1;
+    }
+
+    // The program comes from a file given on the command line (mapped and
+    // loaded in place, then run once), or is typed on stdin up to END and run
+    // on every RUN command.
+    MappedFile programFile;
+    std::vector<std::string> lines;
+    std::string input;
+    if (!programPath.empty()) {
+        if (!programFile.open(programPath)) {
+            std::cout << "Cannot read program file " << programPath << "!" << std::endl;
+            return 1;
+        }
+    } else {
+        std::cout << "BASIC Interpreter\nEnter END to finish input and RUN to execute.\n";
+        while (std::getline(std::cin, input)) {
+            if (input == "END") {
+                break;
+            }
+            lines.push_back(input);
+        }
+        std::cout << "Program input finished. Type RUN to execute.\n";
+    }
+    // --compile and --image work on the file's image, named after it.
+    std::string imagePath = programPath + IMAGE_SUFFIX;
+    if (compile) {
+        return compileImage(programFile.data(), imagePath, options) ? 0 : 1;
+    }
+    ProgramLoader load = [&](Program& target, const ProgramOptions& loadOptions) {
+        return programPath.empty() ? target.load(lines, loadOptions) : target.load(programFile.data(), loadOptions);
+    };
+
+    if (benchRuns > 0) {
+        benchmark(load, benchRuns, options);
+        return 0;
+    }
+
+    Program program;
+    // With --pipeline the first run loads the program as it goes instead, and
+    // with --image it is not loaded unless the image has to be rebuilt.
+    bool loaded = !pipeline || diffEngines || profile;
+    if (loaded && !useImage && !load(program, options)) {
+        reportLoadErrors(program);
+        return 1;
+    }
+    if (optimizerReport && loaded && !useImage && options.optimize) {
+        reportOptimizer(std::cerr, program);
+    }
+
+    // INPUT reads the --data file if there is one, otherwise stdin. Prompts
+    // are only shown when stdin is a terminal.
+    std::unique_ptr<InputSource> data;
+    if (!dataPath.empty()) {
+        data = InputSource::openFile(dataPath);
+        if (!data) {
+            std::cout << "Cannot read data file " << dataPath << "!" << std::endl;
+            return 1;
+        }
+    } else {
+        data = std::make_unique<InputSource>(std::cin, BASIC_ISATTY(0) != 0);
+    }
+
+    if (useImage) {
+        return runImage(programFile.data(), imagePath, options, *data, dumpVariables) ? 0 : 1;
+    }
+
+    if (diffEngines) {
+        // The INPUT data (the --data file, or the rest of stdin) is fed to every engine.
+        std::ostringstream rest;
+        if (!dataPath.empty()) {
+            rest << std::ifstream(dataPath, std::ios::binary).rdbuf();
+        } else {
+            rest << std::cin.rdbuf();
+        }
+        // The reference is the plain tree-walker: no optimizer, nothing fused.
+        ProgramOptions plain;
+        plain.fuse = false;
+        Program reference;
+        load(reference, plain);
+        return differentialCheck(reference, program, rest.str()) ? 0 : 1;
+    }
+
+    // The profile covers every run and is reported on stderr, away from the
+    // program's own output.
+    std::unique_ptr<Profiler> profiler;
+    if (profile) {
+        profiler = std::make_unique<Profiler>();
+        if (!foldedPath.empty()) profiler->enableFolding();
+    }
+    auto reportProfile = [&]() {
+        if (!profiler) return;
+        profiler->report(std::cerr, 20);
+        if (!foldedPath.empty() && !profiler->writeFolded(foldedPath)) {
+            std::cerr << "Cannot write " << foldedPath << "!\n";
+        }
+    };
+
+    OutputSink output(1);
+    auto runOnce = [&]() {
+        Frame frame = program.newFrame();
+        std::cout.flush(); // Earlier messages must come out before PRINT output
+        if (loaded) {
+            program.run(frame, engine, output, *data, profiler.get());
+        } else {
+            bool ok = programPath.empty()
+                ? program.runWhileLoading(lines, options, frame, engine, output, *data)
+                : program.runWhileLoading(programFile.data(), options, frame, engine, output, *data);
+            output.flush();
+            if (!ok) {
+                reportLoadErrors(program);
+                return false;
+            }
+            loaded = true;
+        }
+        output.flush();
+        if (dumpVariables) {
+            dumpFrame(program.symbolTable(), frame);
+        }
+        return true;
+    };
+
+    if (!programPath.empty()) {
+        bool ok = runOnce();
+        reportProfile();
+        return ok ? 0 : 1;
+    }
+    // The program is only parsed once; every RUN re-executes it from a clean state.
+    while (std::getline(std::cin, input)) {
+        if (input == "RUN" && !runOnce()) {
+            return 1;
         }
     }
+    reportProfile();
 
     return 0;
 }
@@ -0,0 +1,9 @@
+10 A = 1
+20 C = 3
+30 FOR I = 1 TO 3
+40 IF (I == 2) B = 4611686018427387904
+50 IF (I == 3) B = 2.5
+60 IF (I == 1) B = 2
+70 Y = A + (B * C)
+80 PRINT Y
+90 NEXT I
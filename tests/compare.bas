@@ -0,0 +1,10 @@
+10 A = 3
+20 B = 2.5
+30 PRINT A > B AND B >= 2.5
+40 PRINT A <> 3 OR A < B OR A <= 3
+50 PRINT 1 + 2 * 3 == 7 AND 10 - 4 - 3 == 3
+60 IF (A == 3) PRINT 1 ELSE PRINT 0
+70 FOR I = 1 TO 5
+80 S = S + I
+90 NEXT I
+100 PRINT S
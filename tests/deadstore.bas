@@ -0,0 +1,14 @@
+10 X = 1
+20 X = 2
+30 PRINT X
+40 Y = 5
+50 Y = Y + 1
+60 Y = 7
+70 PRINT Y
+80 Z = 1
+90 INPUT Z
+100 PRINT Z
+110 V = 1
+120 IF (Z == 42) GOTO 140
+130 V = 2
+140 PRINT V
@@ -0,0 +1,4 @@
+10 PRINT 1
+20 Q = 1 / 0
+30 Q = 3
+40 PRINT Q
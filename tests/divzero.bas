@@ -0,0 +1,3 @@
+10 X = 7
+20 PRINT X / (2 * 3 - 6)
+30 PRINT 2
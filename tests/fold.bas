@@ -0,0 +1,8 @@
+10 Y = 5
+20 X = 2 * 3 + Y * 1 - 0
+30 PRINT X
+40 Z = Y * 0 + 0 * Y
+50 PRINT Z
+60 W = (Y + 0) * (1 * 1) - (0 - 0)
+70 PRINT W
+80 PRINT 7 / 2 + 7 % 3 * 10
@@ -0,0 +1,14 @@
+10 X = 0
+20 Y = 3
+30 FOR I = 1 TO 10
+40 X = X + 1
+50 X = X + Y
+60 IF (X == 12) PRINT X
+70 NEXT I
+80 PRINT X
+90 Y = 2.5
+100 X = X + Y
+110 PRINT X
+120 X = 9223372036854775807
+130 X = X + 1
+140 PRINT X
@@ -0,0 +1,11 @@
+10 X = 0
+20 IF (1) X = X + 1 ELSE X = X + 100
+30 IF (0) X = X + 1000 ELSE GOTO 60
+40 PRINT 999
+50 END
+60 IF (2 - 2) PRINT 888
+70 IF (3 == 3) GOSUB 100
+80 PRINT X
+90 END
+100 X = X * 10
+110 RETURN
@@ -0,0 +1,7 @@
+10 M = 0 - 9223372036854775807 - 1
+20 PRINT M
+30 N = 0 - 1
+40 PRINT M / N
+50 PRINT M % N
+60 PRINT M * N
+70 PRINT (0 - 9223372036854775807 - 1) / (0 - 1)
@@ -0,0 +1,8 @@
+10 A = 9223372036854775807
+20 PRINT A + 1
+30 PRINT 9223372036854775807 + 1
+40 PRINT A * 2
+50 PRINT 4611686018427387904 * 2
+60 B = A - 1 + 1
+70 PRINT B
+80 PRINT 5 / 2.5 + 0.5
@@ -0,0 +1,52 @@
+#!/bin/sh
+# Runs each tests/*.bas on the tree-walker, the VM and the JIT, each with
+# and without -O, and checks the output and exit status against its .out
+# file. INPUT reads the .in file if there is one. A program that finishes
+# must also pass --diff with and without -O, and a .report file is checked
+# against what --opt-report prints.
+#
+# Usage: tests/run.sh [modify binary]   (builds modify.cpp when none is given)
+cd "$(dirname "$0")" || exit 1
+if [ -n "$1" ]; then
+    modify=$1
+else
+    modify=${TMPDIR:-/tmp}/basic-tests-$$
+    ${CXX:-g++} -std=c++17 -O2 -pthread -o "$modify" ../modify.cpp || exit 1
+    trap 'rm -f "$modify"' EXIT
+fi
+
+failed=0
+fail() {
+    echo "FAIL $1: $2"
+    failed=$((failed + 1))
+}
+
+for program in *.bas; do
+    name=${program%.bas}
+    input=/dev/null
+    [ -f "$name.in" ] && input=$name.in
+    for engine in "" --vm --jit; do
+        for optimize in "" -O; do
+            # A run killed by a signal (division by zero) is reported as a
+            # trap; the shell's own message about it is left out.
+            actual=$(exec 2>/dev/null; "$modify" $engine $optimize "$program" <"$input"; status=$?
+                     [ $status -gt 128 ] && status=trap; echo "exit $status")
+            [ "$actual" = "$(cat "$name.out")" ] || fail "$name" "output differs with '$engine $optimize'"
+        done
+    done
+    if grep -q '^exit 0$' "$name.out"; then
+        for optimize in "" -O; do
+            "$modify" $optimize --diff "$program" <"$input" >/dev/null 2>&1 || fail "$name" "--diff $optimize"
+        done
+    fi
+    if [ -f "$name.report" ]; then
+        report=$("$modify" -O --opt-report "$program" <"$input" 2>&1 >/dev/null)
+        [ "$report" = "$(cat "$name.report")" ] || fail "$name" "optimizer report: $report"
+    fi
+done
+
+if [ $failed -ne 0 ]; then
+    echo "$failed failed"
+    exit 1
+fi
+echo "All tests passed."
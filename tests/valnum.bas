@@ -0,0 +1,13 @@
+10 A = 3
+20 B = 4
+30 C = 5
+40 X = (A + B) * C
+50 Y = (A + B) * C + 1
+60 A = 10
+70 Z = (A + B) * C
+80 PRINT X
+90 PRINT Y
+100 PRINT Z
+110 INPUT B
+120 W = (A + B) * C
+130 PRINT W